@@ -25,11 +25,35 @@
 #define CTML_HPP_
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <sstream>
 #include <algorithm>
+#include <cctype>
+#include <memory>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <new>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <chrono>
+#include <exception>
+#include <system_error>
+
+// SSE2 is used to scan for characters that need escaping 16 bytes at a time, where it is available
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CTML_USE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 namespace CTML
 {
@@ -54,6 +78,75 @@ namespace CTML
         return original;
     }
 
+    /**
+     * Finds the first byte at or after the index passed in that an escaper has to replace, returning the size of the
+     * value if there is none, so that the safe run before it can be copied as a whole.
+     * 
+     * A byte has to be replaced if it is one of the special characters passed in, if it is a control character and
+     * controls are escaped, or if it is not ASCII and non-ASCII bytes are escaped. Where SSE2 is available, the value
+     * is scanned 16 bytes at a time, with the remainder scanned one byte at a time.
+     */
+    inline size_t find_escape_byte(
+        const std::string& value,
+        size_t index,
+        const char* specials,
+        bool escapeControls,
+        bool escapeNonAscii)
+    {
+        const size_t specialCount = std::char_traits<char>::length(specials);
+
+#ifdef CTML_USE_SSE2
+        const __m128i controlMax = _mm_set1_epi8(0x1F);
+
+        for (; index + 16 <= value.size(); index += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(value.data() + index));
+
+            __m128i unsafe = _mm_setzero_si128();
+
+            for (size_t special = 0; special < specialCount; special++)
+                unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(specials[special])));
+
+            // a byte is a control character if it is unchanged by clamping it to the last control character
+            if (escapeControls)
+                unsafe = _mm_or_si128(unsafe, _mm_cmpeq_epi8(_mm_min_epu8(chunk, controlMax), chunk));
+
+            int mask = _mm_movemask_epi8(unsafe);
+
+            // the top bit of each byte is only set for bytes that are not ASCII
+            if (escapeNonAscii)
+                mask |= _mm_movemask_epi8(chunk);
+
+            if (mask != 0)
+            {
+#ifdef _MSC_VER
+                unsigned long offset = 0;
+
+                _BitScanForward(&offset, static_cast<unsigned long>(mask));
+
+                return index + offset;
+#else
+                return index + static_cast<size_t>(__builtin_ctz(static_cast<unsigned int>(mask)));
+#endif
+            }
+        }
+#endif
+
+        for (; index < value.size(); index++)
+        {
+            const unsigned char current = static_cast<unsigned char>(value[index]);
+
+            if ((escapeControls && current < 0x20) ||
+                (escapeNonAscii && current >= 0x80) ||
+                std::char_traits<char>::find(specials, specialCount, value[index]) != nullptr)
+            {
+                return index;
+            }
+        }
+
+        return value.size();
+    }
+
     /**
      * Convenience function to escape HTML characters from a value.
      * 
@@ -62,1382 +155,6065 @@ namespace CTML
      */
     inline std::string html_escape(const std::string& value, bool escape_quotes=true)
     {
-        std::string output = value;
+        const char* specials = (escape_quotes) ? "&<>\"'" : "&<>";
+
+        size_t index = find_escape_byte(value, 0, specials, false, false);
 
-        output = replace_all(output, "&", "&amp;");
-        output = replace_all(output, "<", "&lt;");
-        output = replace_all(output, ">", "&gt;");
+        // most values have nothing to escape, so skip building a new string for them
+        if (index == value.size())
+            return value;
 
-        if (escape_quotes)
+        std::string output;
+
+        output.reserve(value.size() + 16);
+
+        size_t start = 0;
+
+        while (index < value.size())
         {
-            output = replace_all(output, "\"", "&quot;");
-            output = replace_all(output, "'", "&apos;");
+            output.append(value, start, index - start);
+
+            switch (value[index])
+            {
+                case '&':
+                    output += "&amp;";
+                    break;
+                case '<':
+                    output += "&lt;";
+                    break;
+                case '>':
+                    output += "&gt;";
+                    break;
+                case '"':
+                    output += "&quot;";
+                    break;
+                case '\'':
+                    output += "&apos;";
+                    break;
+            }
+
+            start = index + 1;
+            index = find_escape_byte(value, start, specials, false, false);
         }
 
+        output.append(value, start, std::string::npos);
+
         return output;
     }
 
-    inline bool string_starts_with(const std::string& src, const std::string& comp)
+    /**
+     * An enum for the different contexts that an attribute value can be escaped for.
+     * 
+     * Every context produces a value that is safe to place in a double quoted attribute, so no other escaping is
+     * needed on top of it.
+     */
+    enum class EscapeContext : uint8_t
     {
-        if (src.size() < comp.size())
-        {
-            return false;
-        }
+        HTML,              // Plain HTML attribute escaping, as done by html_escape
+        URL,               // Percent-encoding for URLs, such as in `href` or `src`, keeping the structure of the URL
+        JAVASCRIPT_STRING, // The contents of a JavaScript string literal, such as data passed to an `onclick` handler
+        CSS_STRING,        // The contents of a CSS string, such as a value in a `style` attribute
+    };
 
-        for (size_t index = 0; index < comp.size(); index++)
-        {
-            // if one character in sequence is not equal, then return false
-            if (comp[index] != src[index])
-            {
-                return false;
-            }
-        }
+    /**
+     * Appends the byte passed in as two uppercase hex digits.
+     */
+    inline void append_hex_byte(std::string& output, unsigned char byte)
+    {
+        static const char digits[] = "0123456789ABCDEF";
 
-        return true;
+        output += digits[byte >> 4];
+        output += digits[byte & 0x0F];
     }
 
-    inline bool string_ends_with(const std::string& src, const std::string& comp)
+    /**
+     * Escapes a URL for use in an attribute.
+     * 
+     * Characters that are not allowed in a URL, such as spaces, quotes, angle brackets, control characters, and
+     * bytes that are not ASCII, are percent-encoded. Characters with a meaning in URLs, such as `/`, `?`, `#`, and
+     * `%`, are kept so that the URL still works, while `&` is escaped as an HTML entity.
+     */
+    inline std::string url_escape(const std::string& value)
     {
-        if (src.size() < comp.size())
-        {
-            return false;
-        }
+        static const char* specials = "&\"'<>\\ `{}|^\x7F";
 
-        size_t compIndex = comp.size() - 1;
+        std::string output;
 
-        for (size_t index = src.size() - 1; index > 0; index--)
+        output.reserve(value.size());
+
+        size_t start = 0;
+        size_t index = find_escape_byte(value, 0, specials, true, true);
+
+        while (index < value.size())
         {
-            // if one character in sequence is not equal, then return false
-            if (comp[compIndex] != src[index])
-            {
-                return false;
-            }
+            output.append(value, start, index - start);
 
-            if (compIndex > 0)
+            if (value[index] == '&')
             {
-                compIndex--;
+                output += "&amp;";
             }
             else
             {
-                break;
+                output += '%';
+
+                append_hex_byte(output, static_cast<unsigned char>(value[index]));
             }
+
+            start = index + 1;
+            index = find_escape_byte(value, start, specials, true, true);
         }
 
-        return true;
+        output.append(value, start, std::string::npos);
+
+        return output;
     }
 
     /**
-     * Internal structure for anything that compares strings by word boundaries.
+     * Escapes a value for use inside a JavaScript string literal in an attribute.
      * 
-     * Instead of copying strings for substr, this just stores the begin and end iterators that represent the word in
-     * the string. Which then is iterated over for comparison to the search word.
+     * Quotes, backslashes, and characters with a meaning in HTML are escaped with JavaScript escape sequences, as are
+     * control characters and the line and paragraph separators, which end a line in JavaScript.
      */
-    struct WordBounds
+    inline std::string javascript_string_escape(const std::string& value)
     {
-        std::string::const_iterator begin;
-        std::string::const_iterator end;
+        // the line and paragraph separators both start with the byte 0xE2 in UTF-8
+        static const char* specials = "\"'\\<>&\x7F\xE2";
 
-        WordBounds() = default;
+        std::string output;
 
-        WordBounds(std::string::const_iterator begin, std::string::const_iterator end)
-            : begin(begin)
-            , end(end) {}
+        output.reserve(value.size());
 
-        bool equals(const std::string& string)
+        size_t start = 0;
+        size_t index = find_escape_byte(value, 0, specials, true, false);
+
+        while (index < value.size())
         {
-            // add one to distance to account for full size
-            size_t boundLength = std::distance(begin, end);
+            output.append(value, start, index - start);
 
-            // word cannot equal string if they are not the same size
-            if (boundLength != string.size())
-            {
-                return false;
-            }
+            const unsigned char current = static_cast<unsigned char>(value[index]);
 
-            size_t index = 0;
+            start = index + 1;
 
-            for (auto& itr = begin; itr != end; ++itr)
+            if (current == 0xE2)
             {
-                if ((*itr) != string[index])
+                if (value.compare(index, 3, "\xE2\x80\xA8") == 0)
                 {
-                    return false;
+                    output += "\\u2028";
+
+                    start = index + 3;
                 }
+                else if (value.compare(index, 3, "\xE2\x80\xA9") == 0)
+                {
+                    output += "\\u2029";
 
-                index++;
+                    start = index + 3;
+                }
+                else
+                {
+                    output += value[index];
+                }
+            }
+            else if (current == '\\')
+            {
+                output += "\\\\";
+            }
+            else if (current == '\n')
+            {
+                output += "\\n";
             }
+            else if (current == '\r')
+            {
+                output += "\\r";
+            }
+            else if (current == '\t')
+            {
+                output += "\\t";
+            }
+            else
+            {
+                output += "\\x";
 
-            return true;
+                append_hex_byte(output, current);
+            }
+
+            index = find_escape_byte(value, start, specials, true, false);
         }
-    };
 
-    inline bool string_contains_word(const std::string& src, const std::string& word)
+        output.append(value, start, std::string::npos);
+
+        return output;
+    }
+
+    /**
+     * Escapes a value for use inside a CSS string in an attribute.
+     * 
+     * Quotes, backslashes, characters with a meaning in HTML, and control characters are escaped with CSS hex
+     * escapes, which are always followed by a space so that the character after them is not read as part of them.
+     */
+    inline std::string css_string_escape(const std::string& value)
     {
-        if (src.size() < word.size())
-        {
-            return false;
-        }
+        static const char* specials = "\"'\\<>&\x7F";
 
-        // split string into words by space
-        std::vector<WordBounds> words;
-        
-        size_t beginIndex = 0;
+        std::string output;
 
-        for (size_t index = 0; index < src.size(); index++)
+        output.reserve(value.size());
+
+        size_t start = 0;
+        size_t index = find_escape_byte(value, 0, specials, true, false);
+
+        while (index < value.size())
         {
-            char current = src.at(index);
+            output.append(value, start, index - start);
 
-            if (current == ' ')
-            {
-                // start the word at the begin index, and end it at the index minus one (last char before space)
-                words.push_back({ src.begin() + beginIndex, src.begin() + index });
+            const unsigned char current = static_cast<unsigned char>(value[index]);
 
-                // start the next word boundary at the subsequent character following this space
-                beginIndex = (index + 1);
+            output += '\\';
 
-                continue;
-            }
+            // CSS hex escapes do not need leading zeros
+            if (current >= 0x10)
+                append_hex_byte(output, current);
+            else
+                output += "0123456789ABCDEF"[current];
+
+            output += ' ';
+
+            start = index + 1;
+            index = find_escape_byte(value, start, specials, true, false);
         }
 
-        // check if we have anything left over for this string for words, and if so, push the final word back
-        if (beginIndex < word.size())
+        output.append(value, start, std::string::npos);
+
+        return output;
+    }
+
+    /**
+     * Escapes an attribute value for the context passed in.
+     */
+    inline std::string escape_value(const std::string& value, EscapeContext context)
+    {
+        switch (context)
         {
-            words.push_back({ src.begin() + beginIndex, src.end() });
+            case EscapeContext::URL:
+                return url_escape(value);
+            case EscapeContext::JAVASCRIPT_STRING:
+                return javascript_string_escape(value);
+            case EscapeContext::CSS_STRING:
+                return css_string_escape(value);
+            case EscapeContext::HTML:
+            default:
+                return html_escape(value);
         }
+    }
 
-        for (auto& bound : words)
+    /**
+     * Hashes a string with 64-bit FNV-1a.
+     * 
+     * This is not meant to be secure, only quick and well distributed for the bit masks and filters used when
+     * matching selectors.
+     */
+    inline uint64_t fnv1a_hash(const char* data, size_t size, uint64_t hash=14695981039346656037ULL)
+    {
+        for (size_t index = 0; index < size; index++)
         {
-            // if equals between a bound and word equals true, then we can return that we found a word
-            if (bound.equals(word))
-            {
-                return true;
-            }
+            hash ^= static_cast<unsigned char>(data[index]);
+            hash *= 1099511628211ULL;
         }
 
-        return false;
+        return hash;
+    }
+
+    inline uint64_t fnv1a_hash(const std::string& value, uint64_t hash=14695981039346656037ULL)
+    {
+        return fnv1a_hash(value.data(), value.size(), hash);
     }
 
     /**
-     * This is probably an *awful* function name but it's to support the |= op for selector attributes
+     * Mixes a 64-bit value into a content hash, using the round of xxHash64.
+     */
+    inline uint64_t content_hash_round(uint64_t hash, uint64_t value)
+    {
+        hash += value * 14029467366897019727ULL;
+        hash  = (hash << 31) | (hash >> 33);
+
+        return hash * 11400714785074694791ULL;
+    }
+
+    /**
+     * Mixes a string into a content hash eight bytes at a time, along with its length, so that the boundaries
+     * between strings that are hashed one after another are part of the hash.
      * 
-     * The operator basically checks if a string is the whole word *or* if the string starts with the word followed by
-     * a hyphen.
+     * Unlike FNV-1a this reads whole words rather than single bytes, which matters for large text and fragments.
      */
-    inline bool string_is_or_begin_hyphen(const std::string& src, const std::string& word)
+    inline uint64_t content_hash_bytes(uint64_t hash, const char* data, size_t size)
     {
-        if (src == word)
-        {
-            return true;
-        }
+        hash = content_hash_round(hash, size);
 
-        if (!string_starts_with(src, word))
-        {
-            return false;
-        }
+        size_t index = 0;
 
-        // if the string isn't big enough to contain the word plus a hyphen, ignore
-        if (src.size() < word.size() + 1)
+        for (; index + 8 <= size; index += 8)
         {
-            return false;
+            uint64_t word;
+
+            std::memcpy(&word, data + index, 8);
+
+            hash = content_hash_round(hash, word);
         }
 
-        // since sizes aren't zero based, this should be where the hyphen is
-        if (src.at(word.size()) != '-')
+        if (index < size)
         {
-            return false;
+            uint64_t word = 0;
+
+            std::memcpy(&word, data + index, size - index);
+
+            hash = content_hash_round(hash, word);
         }
 
-        return true;
+        return hash;
     }
 
-    /**
-     * An enum representing the types of HTML nodes that can be constructed.
-     */
-    enum class NodeType : uint8_t
+    inline uint64_t content_hash_bytes(uint64_t hash, const std::string& value)
     {
-        COMMENT,
-        DOCUMENT_TYPE,
-        ELEMENT,
-        TEXT,
-    };
+        return content_hash_bytes(hash, value.data(), value.size());
+    }
 
     /**
-     * An enum representing the state of the parser for a Node name, akin
-     * to an Emmet abbreviation.
+     * Spreads every bit of a content hash across the whole hash, using the avalanche of xxHash64.
      */
-    enum class SelectorParserState : uint8_t
+    inline uint64_t content_hash_finish(uint64_t hash)
     {
-        NONE,
-        ELEMENT,
-        CLASS,
-        ID,
-        ATTRIBUTE_NAME,
-        ATTRIBUTE_VALUE,
-    };
+        hash ^= hash >> 33;
+        hash *= 14029467366897019727ULL;
+        hash ^= hash >> 29;
+        hash *= 1609587929392839161ULL;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
 
     /**
-     * An enum representing the formatting of the ToString for a Node.
+     * Returns the single bit that represents a class name in a 64-bit class mask.
+     * 
+     * An element keeps the bits of all of its classes in a mask, so a selector whose class bits are not all in
+     * that mask can be rejected with one AND before comparing any strings.
      */
-    enum class StringFormatting : uint8_t
+    inline uint64_t class_mask_bit(const std::string& className)
     {
-        SINGLE_LINE,
-        MULTIPLE_LINES,
-    };
+        return 1ULL << (fnv1a_hash(className) & 63);
+    }
 
     /**
-     * An enum for the different types of selector tokens that can be parsed.
+     * Returns the hash of an element name, id, or class for the ancestor filter, with the kind of value (such as `#`
+     * for an id) hashed first, so that an id and a class with the same name do not share a hash.
      */
-    enum class SelectorTokenType : uint8_t
+    inline uint64_t ancestor_filter_hash(char kind, const std::string& value)
     {
-        ELEMENT,
-        CLASS,
-        ID,
-        ATTRIBUTE_NAME,
-        ATTRIBUTE_VALUE,
-        ATTRIBUTE_COMPARE,
-        SELECTOR_SEPARATOR, // To support searching by selector as well as advanced construction
-    };
+        uint64_t hash = 14695981039346656037ULL;
+
+        hash ^= static_cast<unsigned char>(kind);
+        hash *= 1099511628211ULL;
+
+        return fnv1a_hash(value, hash);
+    }
 
     /**
-     * An enum for the different types of comparison methods that an attribute can have.
+     * A named HTML entity and the code point that it stands for.
      */
-    enum class AttributeComparisonType : uint8_t
+    struct NamedEntity
     {
-        NONE,
-        ATTRIBUTE_EQUAL,
-        ATTRIBUTE_CONTAINS,
-        ATTRIBUTE_CONTAINS_WORD,
-        ATTRIBUTE_STARTS_WITH,
-        ATTRIBUTE_IS_OR_BEGIN_HYPHEN,
-        ATTRIBUTE_ENDS_WITH,
+        const char* name;
+        uint32_t    codePoint;
     };
 
     /**
-     * A struct for options for a ToString call on a Node or Document.
+     * Looks up a named HTML entity, such as `amp`, returning its code point, or zero if it is not known.
+     * 
+     * This covers the HTML 4 entities along with `apos`, using a perfect hash table generated by
+     * tools/generate_entities.py, so a lookup takes two hashes and a single string comparison.
      */
-    struct ToStringOptions
+    inline uint32_t find_named_entity(const char* name, size_t length)
     {
-        StringFormatting formatting;
-        bool trailingNewline;
-        uint32_t indentLevel;
-        bool escapeContent;
+        static const size_t BUCKET_COUNT = 128;
+        static const size_t SLOT_COUNT   = 512;
+
+        static const uint8_t displacements[BUCKET_COUNT] = {
+              2,   0,   1,   4,   1,   0,   1,   1,   0,   0,   0,   1,   1,   2,   3,   0,
+              0,   3,   3,   0,   2,   2,   3,   0,   1,   1,   1,   2,   2,   1,   0,   0,
+              1,   2,   1,   0,   2,   1,   1,   1,   2,   2,   1,   0,   1,   0,   4,   1,
+              7,   0,   1,   0,   0,   1,   2,   0,   1,   0,   1,   0,   1,   1,   0,   0,
+              1,   3,   0,   0,   0,   0,   0,   2,   2,   0,   1,   0,   4,   1,   4,   2,
+              0,   1,   2,   3,   2,   1,   2,   5,   1,   1,   1,   1,   1,   0,   2,   1,
+              0,   1,   3,   2,   4,   0,   3,  12,   1,   0,   2,   0,   0,   4,   1,   0,
+              0,   1,   0,   2,   2,   0,   0,   1,  11,   1,   3,   0,   1,   0,   1,   1,
+        };
+
+        static const NamedEntity entities[SLOT_COUNT] = {
+            { "cup", 0x222A }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "equiv", 0x2261 }, { "crarr", 0x21B5 }, { "", 0 },
+            { "", 0 }, { "lceil", 0x2308 }, { "Sigma", 0x03A3 }, { "agrave", 0x00E0 },
+            { "", 0 }, { "", 0 }, { "exist", 0x2203 }, { "Delta", 0x0394 },
+            { "", 0 }, { "ordf", 0x00AA }, { "", 0 }, { "oslash", 0x00F8 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "ucirc", 0x00FB }, { "", 0 }, { "asymp", 0x2248 },
+            { "", 0 }, { "prop", 0x221D }, { "euml", 0x00EB }, { "", 0 },
+            { "egrave", 0x00E8 }, { "ne", 0x2260 }, { "", 0 }, { "", 0 },
+            { "plusmn", 0x00B1 }, { "iquest", 0x00BF }, { "Mu", 0x039C }, { "", 0 },
+            { "deg", 0x00B0 }, { "", 0 }, { "para", 0x00B6 }, { "alpha", 0x03B1 },
+            { "", 0 }, { "middot", 0x00B7 }, { "AElig", 0x00C6 }, { "", 0 },
+            { "", 0 }, { "cent", 0x00A2 }, { "eacute", 0x00E9 }, { "Omicron", 0x039F },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "loz", 0x25CA },
+            { "gamma", 0x03B3 }, { "", 0 }, { "int", 0x222B }, { "iexcl", 0x00A1 },
+            { "", 0 }, { "Agrave", 0x00C0 }, { "oline", 0x203E }, { "", 0 },
+            { "Phi", 0x03A6 }, { "darr", 0x2193 }, { "", 0 }, { "Iuml", 0x00CF },
+            { "phi", 0x03C6 }, { "fnof", 0x0192 }, { "nsub", 0x2284 }, { "", 0 },
+            { "eta", 0x03B7 }, { "ouml", 0x00F6 }, { "", 0 }, { "", 0 },
+            { "Yacute", 0x00DD }, { "Pi", 0x03A0 }, { "", 0 }, { "Igrave", 0x00CC },
+            { "", 0 }, { "thetasym", 0x03D1 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "chi", 0x03C7 }, { "", 0 },
+            { "", 0 }, { "euro", 0x20AC }, { "or", 0x2228 }, { "", 0 },
+            { "", 0 }, { "Psi", 0x03A8 }, { "emsp", 0x2003 }, { "", 0 },
+            { "iuml", 0x00EF }, { "weierp", 0x2118 }, { "Icirc", 0x00CE }, { "notin", 0x2209 },
+            { "Ucirc", 0x00DB }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "Kappa", 0x039A },
+            { "", 0 }, { "Upsilon", 0x03A5 }, { "frac12", 0x00BD }, { "", 0 },
+            { "", 0 }, { "lang", 0x2329 }, { "", 0 }, { "ETH", 0x00D0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "Theta", 0x0398 },
+            { "", 0 }, { "", 0 }, { "ograve", 0x00F2 }, { "upsilon", 0x03C5 },
+            { "uml", 0x00A8 }, { "perp", 0x22A5 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "Chi", 0x03A7 }, { "", 0 }, { "Xi", 0x039E },
+            { "omega", 0x03C9 }, { "Yuml", 0x0178 }, { "Atilde", 0x00C3 }, { "", 0 },
+            { "permil", 0x2030 }, { "", 0 }, { "Zeta", 0x0396 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "uarr", 0x2191 }, { "Ccedil", 0x00C7 }, { "", 0 },
+            { "Ntilde", 0x00D1 }, { "", 0 }, { "laquo", 0x00AB }, { "aacute", 0x00E1 },
+            { "", 0 }, { "Otilde", 0x00D5 }, { "", 0 }, { "forall", 0x2200 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "sigmaf", 0x03C2 }, { "", 0 }, { "reg", 0x00AE }, { "", 0 },
+            { "", 0 }, { "lrm", 0x200E }, { "sigma", 0x03C3 }, { "", 0 },
+            { "Eta", 0x0397 }, { "Aacute", 0x00C1 }, { "", 0 }, { "macr", 0x00AF },
+            { "", 0 }, { "", 0 }, { "isin", 0x2208 }, { "", 0 },
+            { "cap", 0x2229 }, { "iacute", 0x00ED }, { "Iacute", 0x00CD }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "shy", 0x00AD }, { "Dagger", 0x2021 },
+            { "circ", 0x02C6 }, { "otilde", 0x00F5 }, { "", 0 }, { "ecirc", 0x00EA },
+            { "", 0 }, { "Oslash", 0x00D8 }, { "oplus", 0x2295 }, { "uArr", 0x21D1 },
+            { "ensp", 0x2002 }, { "iota", 0x03B9 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "raquo", 0x00BB },
+            { "xi", 0x03BE }, { "micro", 0x00B5 }, { "rArr", 0x21D2 }, { "bdquo", 0x201E },
+            { "Ugrave", 0x00D9 }, { "Nu", 0x039D }, { "sum", 0x2211 }, { "", 0 },
+            { "oelig", 0x0153 }, { "not", 0x00AC }, { "Beta", 0x0392 }, { "yuml", 0x00FF },
+            { "", 0 }, { "", 0 }, { "uuml", 0x00FC }, { "lArr", 0x21D0 },
+            { "gt", 0x003E }, { "alefsym", 0x2135 }, { "omicron", 0x03BF }, { "oacute", 0x00F3 },
+            { "", 0 }, { "thorn", 0x00FE }, { "rsquo", 0x2019 }, { "", 0 },
+            { "thinsp", 0x2009 }, { "acute", 0x00B4 }, { "sim", 0x223C }, { "", 0 },
+            { "", 0 }, { "ndash", 0x2013 }, { "frac34", 0x00BE }, { "Ograve", 0x00D2 },
+            { "", 0 }, { "supe", 0x2287 }, { "", 0 }, { "pi", 0x03C0 },
+            { "", 0 }, { "rang", 0x232A }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "sub", 0x2282 }, { "cong", 0x2245 }, { "upsih", 0x03D2 },
+            { "", 0 }, { "theta", 0x03B8 }, { "", 0 }, { "Scaron", 0x0160 },
+            { "", 0 }, { "Epsilon", 0x0395 }, { "", 0 }, { "Auml", 0x00C4 },
+            { "lsquo", 0x2018 }, { "Uacute", 0x00DA }, { "", 0 }, { "sdot", 0x22C5 },
+            { "", 0 }, { "", 0 }, { "Ouml", 0x00D6 }, { "", 0 },
+            { "rarr", 0x2192 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "prod", 0x220F }, { "", 0 },
+            { "sup1", 0x00B9 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "Oacute", 0x00D3 }, { "mu", 0x03BC }, { "Prime", 0x2033 },
+            { "brvbar", 0x00A6 }, { "", 0 }, { "", 0 }, { "Ecirc", 0x00CA },
+            { "real", 0x211C }, { "uacute", 0x00FA }, { "", 0 }, { "rho", 0x03C1 },
+            { "", 0 }, { "and", 0x2227 }, { "", 0 }, { "atilde", 0x00E3 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "Acirc", 0x00C2 },
+            { "lsaquo", 0x2039 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "cedil", 0x00B8 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "frac14", 0x00BC }, { "lowast", 0x2217 }, { "", 0 }, { "sup2", 0x00B2 },
+            { "yen", 0x00A5 }, { "", 0 }, { "part", 0x2202 }, { "larr", 0x2190 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "ocirc", 0x00F4 }, { "THORN", 0x00DE }, { "", 0 }, { "psi", 0x03C8 },
+            { "", 0 }, { "bull", 0x2022 }, { "mdash", 0x2014 }, { "sect", 0x00A7 },
+            { "", 0 }, { "", 0 }, { "Ocirc", 0x00D4 }, { "", 0 },
+            { "", 0 }, { "spades", 0x2660 }, { "quot", 0x0022 }, { "", 0 },
+            { "hearts", 0x2665 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "OElig", 0x0152 }, { "Gamma", 0x0393 }, { "", 0 }, { "", 0 },
+            { "nu", 0x03BD }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "harr", 0x2194 },
+            { "", 0 }, { "", 0 }, { "times", 0x00D7 }, { "", 0 },
+            { "", 0 }, { "radic", 0x221A }, { "nabla", 0x2207 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "there4", 0x2234 },
+            { "", 0 }, { "", 0 }, { "hellip", 0x2026 }, { "Iota", 0x0399 },
+            { "yacute", 0x00FD }, { "Eacute", 0x00C9 }, { "", 0 }, { "", 0 },
+            { "ge", 0x2265 }, { "", 0 }, { "", 0 }, { "Omega", 0x03A9 },
+            { "Alpha", 0x0391 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "rsaquo", 0x203A }, { "pound", 0x00A3 }, { "", 0 },
+            { "", 0 }, { "ccedil", 0x00E7 }, { "", 0 }, { "Rho", 0x03A1 },
+            { "", 0 }, { "", 0 }, { "ni", 0x220B }, { "", 0 },
+            { "kappa", 0x03BA }, { "tau", 0x03C4 }, { "curren", 0x00A4 }, { "aring", 0x00E5 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "nbsp", 0x00A0 },
+            { "zwnj", 0x200C }, { "image", 0x2111 }, { "amp", 0x0026 }, { "Euml", 0x00CB },
+            { "", 0 }, { "", 0 }, { "Egrave", 0x00C8 }, { "eth", 0x00F0 },
+            { "", 0 }, { "sup3", 0x00B3 }, { "", 0 }, { "", 0 },
+            { "auml", 0x00E4 }, { "", 0 }, { "", 0 }, { "zeta", 0x03B6 },
+            { "delta", 0x03B4 }, { "", 0 }, { "trade", 0x2122 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "zwj", 0x200D },
+            { "apos", 0x0027 }, { "", 0 }, { "szlig", 0x00DF }, { "", 0 },
+            { "minus", 0x2212 }, { "icirc", 0x00EE }, { "aelig", 0x00E6 }, { "divide", 0x00F7 },
+            { "sup", 0x2283 }, { "", 0 }, { "", 0 }, { "dArr", 0x21D3 },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "lfloor", 0x230A },
+            { "ntilde", 0x00F1 }, { "", 0 }, { "Uuml", 0x00DC }, { "prime", 0x2032 },
+            { "scaron", 0x0161 }, { "", 0 }, { "", 0 }, { "hArr", 0x21D4 },
+            { "", 0 }, { "otimes", 0x2297 }, { "rlm", 0x200F }, { "", 0 },
+            { "lt", 0x003C }, { "", 0 }, { "Aring", 0x00C5 }, { "", 0 },
+            { "", 0 }, { "tilde", 0x02DC }, { "", 0 }, { "acirc", 0x00E2 },
+            { "", 0 }, { "", 0 }, { "diams", 0x2666 }, { "", 0 },
+            { "frasl", 0x2044 }, { "rdquo", 0x201D }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "rceil", 0x2309 }, { "epsilon", 0x03B5 }, { "Lambda", 0x039B },
+            { "", 0 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "sbquo", 0x201A }, { "", 0 }, { "", 0 }, { "sube", 0x2286 },
+            { "", 0 }, { "clubs", 0x2663 }, { "ang", 0x2220 }, { "ldquo", 0x201C },
+            { "igrave", 0x00EC }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "copy", 0x00A9 }, { "Tau", 0x03A4 }, { "empty", 0x2205 }, { "", 0 },
+            { "infin", 0x221E }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "ugrave", 0x00F9 }, { "", 0 }, { "", 0 }, { "", 0 },
+            { "", 0 }, { "", 0 }, { "beta", 0x03B2 }, { "lambda", 0x03BB },
+            { "", 0 }, { "rfloor", 0x230B }, { "dagger", 0x2020 }, { "piv", 0x03D6 },
+            { "le", 0x2264 }, { "", 0 }, { "ordm", 0x00BA }, { "", 0 },
+        };
+
+        if (length == 0)
+            return 0;
+
+        const uint8_t displacement = displacements[fnv1a_hash(name, length) % BUCKET_COUNT];
+
+        const NamedEntity& entity = entities[fnv1a_hash(name, length, 14695981039346656037ULL ^ displacement) % SLOT_COUNT];
+
+        if (std::char_traits<char>::length(entity.name) != length ||
+            std::char_traits<char>::compare(entity.name, name, length) != 0)
+        {
+            return 0;
+        }
 
-        ToStringOptions(
-            StringFormatting formatting=StringFormatting::SINGLE_LINE,
-            bool trailingNewLine=false,
-            uint32_t indentLevel=0,
-            bool escapeContent=true)
-            : formatting(formatting)
-            , trailingNewline(trailingNewLine)
-            , indentLevel(indentLevel)
-            , escapeContent(escapeContent) {}
-    };
+        return entity.codePoint;
+    }
 
     /**
-     * A struct for selector tokens from parsing a selector.
+     * Encodes a code point as UTF-8 into the buffer passed in, which must have room for four bytes, returning the
+     * number of bytes written.
      */
-    struct SelectorToken
+    inline size_t encode_utf8(uint32_t codePoint, char* output)
     {
-        SelectorTokenType       type       = SelectorTokenType::ELEMENT;
-        std::string             value      = "";
-        AttributeComparisonType comparison = AttributeComparisonType::NONE;
+        if (codePoint < 0x80)
+        {
+            output[0] = static_cast<char>(codePoint);
 
-        SelectorToken(
-            SelectorTokenType type=SelectorTokenType::ELEMENT,
-            std::string value="",
-            AttributeComparisonType comparison=AttributeComparisonType::NONE)
-            : type(type)
-            , value(value)
-            , comparison(comparison) {}
-    };
+            return 1;
+        }
 
-    /**
-     * Adds a single selector token to the token vector passed in based on the
-     * state of the parser that was passed.
-     */
-    inline void add_selector_token(
-        std::vector<SelectorToken>& tokens,
-        SelectorParserState state,
-        const std::string& value)
-    {
-        switch (state)
+        if (codePoint < 0x800)
         {
-            case SelectorParserState::ELEMENT:
-                tokens.push_back({ SelectorTokenType::ELEMENT, value });
-                break;
-            case SelectorParserState::CLASS:
-                tokens.push_back({ SelectorTokenType::CLASS, value });
-                break;
-            case SelectorParserState::ID:
-                tokens.push_back({ SelectorTokenType::ID, value });
-                break;
-            case SelectorParserState::ATTRIBUTE_NAME:
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_NAME, value });
-                break;
-            case SelectorParserState::ATTRIBUTE_VALUE:
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_VALUE, value });
-                break;
-            // do nothing for any other type as we can't determine a token
-            case SelectorParserState::NONE:
-            default:
-                break;
+            output[0] = static_cast<char>(0xC0 | (codePoint >> 6));
+            output[1] = static_cast<char>(0x80 | (codePoint & 0x3F));
+
+            return 2;
         }
-    }
 
-    /**
-     * Grabs the character that is one ahead of the index passed in.
-     * 
-     * Used as a convenience method for selector parsing to get a lookahead while also doing bounds checking.
-     * 
-     * Returns either the character that is at the position one ahead of the index, or a null char.
-     */
-    inline const char get_lookahead_char(const std::string& selector, size_t index)
-    {
-        if (selector.size() <= index + 1)
+        if (codePoint < 0x10000)
         {
-            return '\0';
+            output[0] = static_cast<char>(0xE0 | (codePoint >> 12));
+            output[1] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            output[2] = static_cast<char>(0x80 | (codePoint & 0x3F));
+
+            return 3;
         }
 
-        return selector.at(index + 1);
+        output[0] = static_cast<char>(0xF0 | (codePoint >> 18));
+        output[1] = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        output[2] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        output[3] = static_cast<char>(0x80 | (codePoint & 0x3F));
+
+        return 4;
     }
 
     /**
-     * Parses a string representation of a CSS selector into a vector of tokens.
-     * 
-     * This parser isn't meant to be comprehensive and robust, just merely to
-     * allow searching for elements via common selectors and to parse Emmet-like
-     * abbriviations for use in creating nodes.
+     * Decodes the HTML entities in a value in place, the counterpart to html_escape.
      * 
-     * This parser particularly just scans the string from start to finish
-     * character by character, and thus might be slow on very large strings
-     * or very complex selectors.
+     * Named entities need their closing semicolon, while it is optional for decimal (`&#38;`) and hex (`&#x26;`)
+     * entities. Numeric entities for code points that are not allowed are decoded as U+FFFD, and anything that is not
+     * a known entity is left as it is. Every entity is at least as long as its UTF-8 encoding, so the value never
+     * has to grow, and the text between entities is found with the same scanner as the escapers.
      */
-    inline std::vector<SelectorToken> parse_selector(const std::string& selector)
+    inline void html_unescape_in_place(std::string& value)
     {
-        std::vector<SelectorToken> tokens;
-
-        // start the parser to be parsing an element by default
-        SelectorParserState state = SelectorParserState::ELEMENT;
+        size_t read = find_escape_byte(value, 0, "&", false, false);
 
-        std::string temp = "";
+        if (read == value.size())
+            return;
 
-        // whether to skip the following character in the selector, used for attribute matching parsing when we perform
-        // a lookahead for the equal sign on a character, if the following character is an equal sign, then we skip it
-        bool skipNext = false;
+        size_t write = read;
 
-        for (size_t index = 0; index < selector.size(); index++)
+        while (read < value.size())
         {
-            const char& current = selector.at(index);
-
-            if (skipNext)
-            {
-                skipNext = false;
+            // the read position is always on an ampersand here
+            size_t end = read + 1;
 
-                continue;
-            }
+            uint32_t codePoint = 0;
 
-            if (current == '.')
+            if (end < value.size() && value[end] == '#')
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                end++;
 
-                temp = "";
+                const bool hex = (end < value.size() && (value[end] == 'x' || value[end] == 'X'));
 
-                state = SelectorParserState::CLASS;
+                if (hex)
+                    end++;
 
-                continue;
-            }
-            else if (current == '#')
-            {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                const size_t digits = end;
 
-                temp = "";
+                uint32_t number = 0;
 
-                state = SelectorParserState::ID;
+                for (; end < value.size(); end++)
+                {
+                    const char current = value[end];
 
-                continue;
-            }
-            // only treat spaces as a split character if we aren't parsing attributes
-            // as these attribute strings are allowed to have spaces
-            else if (current == ' ' && state != SelectorParserState::ATTRIBUTE_VALUE)
-            {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                    uint32_t digit = 0;
 
-                // add an extra token to the token vector that signifies a split
-                tokens.push_back({ SelectorTokenType::SELECTOR_SEPARATOR, "" });
+                    if (current >= '0' && current <= '9')
+                        digit = current - '0';
+                    else if (hex && current >= 'a' && current <= 'f')
+                        digit = current - 'a' + 10;
+                    else if (hex && current >= 'A' && current <= 'F')
+                        digit = current - 'A' + 10;
+                    else
+                        break;
 
-                temp = "";
+                    // stop growing the number once it is out of range, it only has to stay out of range
+                    if (number <= 0x10FFFF)
+                        number = number * (hex ? 16 : 10) + digit;
+                }
 
-                state = SelectorParserState::ELEMENT;
+                if (end > digits)
+                {
+                    if (end < value.size() && value[end] == ';')
+                        end++;
 
-                continue;
+                    codePoint = number;
+
+                    if (number == 0 || number > 0x10FFFF || (number >= 0xD800 && number <= 0xDFFF))
+                        codePoint = 0xFFFD;
+                }
             }
-            else if (current == '[')
+            else
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
-
-                temp = "";
+                while (end < value.size() && std::isalnum(static_cast<unsigned char>(value[end])))
+                    end++;
 
-                state = SelectorParserState::ATTRIBUTE_NAME;
+                if (end < value.size() && value[end] == ';')
+                {
+                    codePoint = find_named_entity(value.data() + read + 1, end - read - 1);
 
-                continue;
+                    if (codePoint != 0)
+                        end++;
+                }
             }
-            else if (current == '~' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
-            {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
 
-                // add an extra token for selector match equal
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "~=", AttributeComparisonType::ATTRIBUTE_CONTAINS_WORD });
-
-                temp = "";
+            if (codePoint != 0)
+            {
+                char bytes[4];
 
-                state = SelectorParserState::ATTRIBUTE_VALUE;
+                size_t length = encode_utf8(codePoint, bytes);
 
-                skipNext = true;
+                std::char_traits<char>::copy(&value[write], bytes, length);
 
-                continue;
+                write += length;
+                read   = end;
             }
-            else if (current == '|' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            else
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
-
-                // add an extra token for selector match equal
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "|=", AttributeComparisonType::ATTRIBUTE_IS_OR_BEGIN_HYPHEN });
-
-                temp = "";
+                value[write++] = value[read++];
+            }
 
-                state = SelectorParserState::ATTRIBUTE_VALUE;
+            // move the text up to the next ampersand back over the space freed by decoding
+            size_t next = find_escape_byte(value, read, "&", false, false);
 
-                skipNext = true;
+            if (write != read)
+                std::char_traits<char>::move(&value[write], value.data() + read, next - read);
 
-                continue;
-            }
-            else if (current == '^' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
-            {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+            write += next - read;
+            read   = next;
+        }
 
-                // add an extra token for selector match equal
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "^=", AttributeComparisonType::ATTRIBUTE_STARTS_WITH });
+        value.resize(write);
+    }
 
-                temp = "";
+    /**
+     * Decodes the HTML entities in a value, the counterpart to html_escape.
+     * 
+     * See html_unescape_in_place for more info.
+     */
+    inline std::string html_unescape(std::string value)
+    {
+        html_unescape_in_place(value);
 
-                state = SelectorParserState::ATTRIBUTE_VALUE;
+        return value;
+    }
 
-                skipNext = true;
+    inline bool string_starts_with(const std::string& src, const std::string& comp)
+    {
+        if (src.size() < comp.size())
+        {
+            return false;
+        }
 
-                continue;
-            }
-            else if (current == '$' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+        for (size_t index = 0; index < comp.size(); index++)
+        {
+            // if one character in sequence is not equal, then return false
+            if (comp[index] != src[index])
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                return false;
+            }
+        }
 
-                // add an extra token for selector match equal
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "$=", AttributeComparisonType::ATTRIBUTE_ENDS_WITH });
+        return true;
+    }
 
-                temp = "";
+    inline bool string_ends_with(const std::string& src, const std::string& comp)
+    {
+        if (src.size() < comp.size())
+        {
+            return false;
+        }
 
-                state = SelectorParserState::ATTRIBUTE_VALUE;
+        size_t compIndex = comp.size() - 1;
 
-                skipNext = true;
+        for (size_t index = src.size() - 1; index > 0; index--)
+        {
+            // if one character in sequence is not equal, then return false
+            if (comp[compIndex] != src[index])
+            {
+                return false;
+            }
 
-                continue;
+            if (compIndex > 0)
+            {
+                compIndex--;
             }
-            else if (current == '*' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            else
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                break;
+            }
+        }
 
-                // add an extra token for selector match equal
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "*=", AttributeComparisonType::ATTRIBUTE_CONTAINS });
+        return true;
+    }
 
-                temp = "";
+    /**
+     * Internal structure for anything that compares strings by word boundaries.
+     * 
+     * Instead of copying strings for substr, this just stores the begin and end iterators that represent the word in
+     * the string. Which then is iterated over for comparison to the search word.
+     */
+    struct WordBounds
+    {
+        std::string::const_iterator begin;
+        std::string::const_iterator end;
 
-                state = SelectorParserState::ATTRIBUTE_VALUE;
+        WordBounds() = default;
 
-                skipNext = true;
+        WordBounds(std::string::const_iterator begin, std::string::const_iterator end)
+            : begin(begin)
+            , end(end) {}
 
-                continue;
+        bool equals(const std::string& string)
+        {
+            // add one to distance to account for full size
+            size_t boundLength = std::distance(begin, end);
+
+            // word cannot equal string if they are not the same size
+            if (boundLength != string.size())
+            {
+                return false;
             }
-            else if (current == '=' && state == SelectorParserState::ATTRIBUTE_NAME)
+
+            size_t index = 0;
+
+            for (auto& itr = begin; itr != end; ++itr)
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                if ((*itr) != string[index])
+                {
+                    return false;
+                }
 
-                // add an extra token for selector match equal
-                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "=", AttributeComparisonType::ATTRIBUTE_EQUAL });
+                index++;
+            }
 
-                temp = "";
+            return true;
+        }
+    };
 
-                state = SelectorParserState::ATTRIBUTE_VALUE;
+    inline bool string_contains_word(const std::string& src, const std::string& word)
+    {
+        if (src.size() < word.size())
+        {
+            return false;
+        }
+
+        // split string into words by space
+        std::vector<WordBounds> words;
+        
+        size_t beginIndex = 0;
+
+        for (size_t index = 0; index < src.size(); index++)
+        {
+            char current = src.at(index);
+
+            if (current == ' ')
+            {
+                // start the word at the begin index, and end it at the index minus one (last char before space)
+                words.push_back({ src.begin() + beginIndex, src.begin() + index });
+
+                // start the next word boundary at the subsequent character following this space
+                beginIndex = (index + 1);
 
                 continue;
             }
-            // ignore quotes for attribute values as they aren't necessary for
-            // the value of the attribute
-            else if (current == '"' && state == SelectorParserState::ATTRIBUTE_VALUE)
+        }
+
+        // check if we have anything left over for this string for words, and if so, push the final word back
+        if (beginIndex < word.size())
+        {
+            words.push_back({ src.begin() + beginIndex, src.end() });
+        }
+
+        for (auto& bound : words)
+        {
+            // if equals between a bound and word equals true, then we can return that we found a word
+            if (bound.equals(word))
             {
-                continue;
+                return true;
             }
-            // ignore right square brackets if we are parsing an attribute name
-            // or an attribute value
-            else if (
-                current == ']' &&
-                (state == SelectorParserState::ATTRIBUTE_NAME ||
-                 state == SelectorParserState::ATTRIBUTE_VALUE)
-            )
+        }
+
+        return false;
+    }
+
+    /**
+     * This is probably an *awful* function name but it's to support the |= op for selector attributes
+     * 
+     * The operator basically checks if a string is the whole word *or* if the string starts with the word followed by
+     * a hyphen.
+     */
+    inline bool string_is_or_begin_hyphen(const std::string& src, const std::string& word)
+    {
+        if (src == word)
+        {
+            return true;
+        }
+
+        if (!string_starts_with(src, word))
+        {
+            return false;
+        }
+
+        // if the string isn't big enough to contain the word plus a hyphen, ignore
+        if (src.size() < word.size() + 1)
+        {
+            return false;
+        }
+
+        // since sizes aren't zero based, this should be where the hyphen is
+        if (src.at(word.size()) != '-')
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * An enum representing the types of HTML nodes that can be constructed.
+     */
+    enum class NodeType : uint8_t
+    {
+        COMMENT,
+        DOCUMENT_TYPE,
+        ELEMENT,
+        SLOT,
+        STATIC_FRAGMENT,
+        TEXT,
+    };
+
+    /**
+     * An enum representing the state of the parser for a Node name, akin
+     * to an Emmet abbreviation.
+     */
+    enum class SelectorParserState : uint8_t
+    {
+        NONE,
+        ELEMENT,
+        CLASS,
+        ID,
+        ATTRIBUTE_NAME,
+        ATTRIBUTE_VALUE,
+    };
+
+    /**
+     * An enum representing the formatting of the ToString for a Node.
+     */
+    enum class StringFormatting : uint8_t
+    {
+        SINGLE_LINE,
+        MULTIPLE_LINES,
+    };
+
+    /**
+     * An enum for how text and attribute values are encoded in the output of a ToString for a Node.
+     */
+    enum class OutputEncoding : uint8_t
+    {
+        UTF8,           // Values are output as they are, without any checks
+        VALIDATED_UTF8, // Invalid UTF-8 in values is replaced with the replacement character, U+FFFD
+        ASCII,          // As VALIDATED_UTF8, with every character that is not ASCII output as a numeric entity
+    };
+
+    /**
+     * Decodes the UTF-8 sequence that starts at the index passed in, returning its length in bytes, or zero if the
+     * sequence is not valid UTF-8, such as an overlong encoding, a surrogate, or a truncated sequence.
+     */
+    inline size_t decode_utf8_sequence(const std::string& value, size_t index, uint32_t& codePoint)
+    {
+        const unsigned char lead = static_cast<unsigned char>(value[index]);
+
+        size_t length = 0;
+
+        // the range that the first continuation byte must be in, which rules out overlong encodings and surrogates
+        unsigned char low  = 0x80;
+        unsigned char high = 0xBF;
+
+        if (lead < 0x80)
+        {
+            codePoint = lead;
+
+            return 1;
+        }
+        else if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            length    = 2;
+            codePoint = lead & 0x1F;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            length    = 3;
+            codePoint = lead & 0x0F;
+
+            if (lead == 0xE0)
+                low = 0xA0;
+            else if (lead == 0xED)
+                high = 0x9F;
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            length    = 4;
+            codePoint = lead & 0x07;
+
+            if (lead == 0xF0)
+                low = 0x90;
+            else if (lead == 0xF4)
+                high = 0x8F;
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (index + length > value.size())
+            return 0;
+
+        for (size_t offset = 1; offset < length; offset++)
+        {
+            const unsigned char continuation = static_cast<unsigned char>(value[index + offset]);
+
+            if (continuation < low || continuation > high)
+                return 0;
+
+            codePoint = (codePoint << 6) | (continuation & 0x3F);
+
+            low  = 0x80;
+            high = 0xBF;
+        }
+
+        return length;
+    }
+
+    /**
+     * Appends a value to the output with the encoding passed in.
+     * 
+     * Runs of ASCII are found with the same scanner as the escapers and copied as a whole, so only the bytes that are
+     * not ASCII are decoded, and the value is only passed over once. Invalid sequences are replaced one byte at a time.
+     */
+    inline void append_encoded(std::string& output, const std::string& value, OutputEncoding encoding)
+    {
+        if (encoding == OutputEncoding::UTF8)
+        {
+            output += value;
+
+            return;
+        }
+
+        size_t start = 0;
+        size_t index = find_escape_byte(value, 0, "", false, true);
+
+        while (index < value.size())
+        {
+            output.append(value, start, index - start);
+
+            uint32_t codePoint = 0;
+
+            size_t length = decode_utf8_sequence(value, index, codePoint);
+
+            if (encoding == OutputEncoding::ASCII)
             {
-                if (!temp.empty())
-                    add_selector_token(tokens, state, temp);
+                if (length == 0)
+                    codePoint = 0xFFFD;
 
-                temp = "";
+                output += "&#x";
+
+                // output the hex digits of the code point without leading zeros
+                int shift = 20;
+
+                while (shift > 0 && (codePoint >> shift) == 0)
+                    shift -= 4;
+
+                for (; shift >= 0; shift -= 4)
+                    output += "0123456789ABCDEF"[(codePoint >> shift) & 0x0F];
+
+                output += ";";
+            }
+            else if (length == 0)
+            {
+                output += "\xEF\xBF\xBD";
+            }
+            else
+            {
+                output.append(value, index, length);
+            }
+
+            start = index + std::max<size_t>(length, 1);
+            index = find_escape_byte(value, start, "", false, true);
+        }
+
+        output.append(value, start, std::string::npos);
+    }
+
+    /**
+     * An enum for the different types of selector tokens that can be parsed.
+     */
+    enum class SelectorTokenType : uint8_t
+    {
+        ELEMENT,
+        CLASS,
+        ID,
+        ATTRIBUTE_NAME,
+        ATTRIBUTE_VALUE,
+        ATTRIBUTE_COMPARE,
+        SELECTOR_SEPARATOR,       // To support searching by selector as well as advanced construction
+        SELECTOR_CHILD,           // The `>` combinator, a child in construction
+        SELECTOR_SIBLING,         // The `+` combinator, a sibling of the previous element in construction
+        SELECTOR_GENERAL_SIBLING, // The `~` combinator, any later sibling, treated as `+` in construction
+        MULTIPLIER,               // An Emmet `*N` multiplier, only used for construction
+        SELECTOR_LIST,            // The `,` between selectors in a selector list, only used for searching
+        PSEUDO_CLASS,             // A `:name` or `:name(argument)` pseudo-class, only used for searching
+    };
+
+    /**
+     * An enum for the different types of comparison methods that an attribute can have.
+     */
+    enum class AttributeComparisonType : uint8_t
+    {
+        NONE,
+        ATTRIBUTE_EQUAL,
+        ATTRIBUTE_CONTAINS,
+        ATTRIBUTE_CONTAINS_WORD,
+        ATTRIBUTE_STARTS_WITH,
+        ATTRIBUTE_IS_OR_BEGIN_HYPHEN,
+        ATTRIBUTE_ENDS_WITH,
+    };
+
+    /**
+     * An enum for the structural pseudo-classes that can be searched for.
+     */
+    enum class PseudoClassType : uint8_t
+    {
+        UNKNOWN, // A pseudo-class that is not supported, which never matches
+        FIRST_CHILD,
+        LAST_CHILD,
+        NTH_CHILD,
+        NTH_OF_TYPE,
+        EMPTY,
+        NOT,
+    };
+
+    /**
+     * Checks if an attribute value matches the value from a selector using the comparison passed in.
+     * 
+     * A comparison of NONE only checks that the attribute exists, so it always matches.
+     */
+    inline bool attribute_value_matches(
+        const std::string& value,
+        AttributeComparisonType comparison,
+        const std::string& search)
+    {
+        switch (comparison)
+        {
+            case AttributeComparisonType::ATTRIBUTE_EQUAL:
+                return value == search;
+            case AttributeComparisonType::ATTRIBUTE_CONTAINS:
+                return value.find(search) != std::string::npos;
+            case AttributeComparisonType::ATTRIBUTE_CONTAINS_WORD:
+                return string_contains_word(value, search);
+            case AttributeComparisonType::ATTRIBUTE_STARTS_WITH:
+                return string_starts_with(value, search);
+            case AttributeComparisonType::ATTRIBUTE_IS_OR_BEGIN_HYPHEN:
+                return string_is_or_begin_hyphen(value, search);
+            case AttributeComparisonType::ATTRIBUTE_ENDS_WITH:
+                return string_ends_with(value, search);
+            case AttributeComparisonType::NONE:
+            default:
+                return true;
+        }
+    }
+
+    /**
+     * A cache of rendered fragments, looked up by keys that are chosen by the user.
+     * 
+     * The cache holds at most the number of bytes that it was created with, counting both keys and fragments, and a
+     * single fragment may use up to all of them. Fragments may also expire a set time after they were stored. The
+     * cache is split into shards that are each locked on their own, so it can be shared by many threads at once with
+     * little contention. Once the cache is full, the least recently used fragments of the shard being stored to are
+     * evicted first, followed by those of the other shards, so the order of eviction is only kept within a shard.
+     * 
+     * Setting the cache on the options passed to ToString renders every node that has a cache key through the cache.
+     * The cache does not know when a node changes, so the key should change along with the content of the node.
+     */
+    class FragmentCache
+    {
+    public:
+        FragmentCache(
+            size_t byteBudget,
+            std::chrono::milliseconds timeToLive=std::chrono::milliseconds(0),
+            size_t shardCount=16)
+            : m_shards((shardCount > 0) ? shardCount : 1)
+            , m_byteBudget(byteBudget)
+            , m_bytes(0)
+            , m_timeToLive(timeToLive) {}
+
+        FragmentCache(const FragmentCache&) = delete;
+        FragmentCache& operator=(const FragmentCache&) = delete;
+
+        /**
+         * Return the fragment stored for the key passed in, or null if it is not stored or has expired.
+         */
+        std::shared_ptr<const std::string> Get(const std::string& key)
+        {
+            Shard& shard = this->ShardFor(key);
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            auto find = shard.index.find(key);
+
+            if (find == shard.index.end())
+                return nullptr;
+
+            if (this->Expired(*find->second))
+            {
+                this->EraseEntry(shard, find);
+
+                return nullptr;
+            }
+
+            // move the fragment to the front so that it is evicted last
+            shard.entries.splice(shard.entries.begin(), shard.entries, find->second);
+
+            return find->second->bytes;
+        }
+
+        /**
+         * Store a fragment for the key passed in, replacing any fragment that was stored for it, and return the
+         * stored fragment.
+         * 
+         * A fragment that is larger than the whole budget is returned without being stored.
+         */
+        std::shared_ptr<const std::string> Put(const std::string& key, std::string bytes)
+        {
+            std::shared_ptr<const std::string> fragment = std::make_shared<const std::string>(std::move(bytes));
+
+            const size_t cost  = key.size() + fragment->size();
+            const size_t index = this->ShardIndex(key);
+
+            {
+                Shard& shard = m_shards[index];
+
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto find = shard.index.find(key);
+
+                if (find != shard.index.end())
+                    this->EraseEntry(shard, find);
+
+                if (cost > m_byteBudget)
+                    return fragment;
+
+                Entry entry;
+
+                entry.key   = key;
+                entry.bytes = fragment;
+
+                if (m_timeToLive.count() > 0)
+                    entry.expires = std::chrono::steady_clock::now() + m_timeToLive;
+
+                shard.entries.push_front(std::move(entry));
+                shard.index[key] = shard.entries.begin();
+                shard.bytes     += cost;
+
+                m_bytes += cost;
+
+                // make room in this shard first, keeping the fragment that was just stored
+                while (m_bytes > m_byteBudget && shard.entries.size() > 1)
+                    this->EraseEntry(shard, shard.index.find(shard.entries.back().key));
+            }
+
+            // then in the other shards, which are locked one at a time so that two puts can never wait on each other
+            for (size_t offset = 1; offset < m_shards.size() && m_bytes > m_byteBudget; offset++)
+            {
+                Shard& shard = m_shards[(index + offset) % m_shards.size()];
+
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                while (m_bytes > m_byteBudget && !shard.entries.empty())
+                    this->EraseEntry(shard, shard.index.find(shard.entries.back().key));
+            }
+
+            return fragment;
+        }
+
+        /**
+         * Remove the fragment stored for the key passed in, returning whether one was stored.
+         */
+        bool Erase(const std::string& key)
+        {
+            Shard& shard = this->ShardFor(key);
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            auto find = shard.index.find(key);
+
+            if (find == shard.index.end())
+                return false;
+
+            this->EraseEntry(shard, find);
+
+            return true;
+        }
+
+        /**
+         * Remove every fragment from the cache.
+         */
+        void Clear()
+        {
+            for (auto& shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                shard.entries.clear();
+                shard.index.clear();
+
+                m_bytes -= shard.bytes;
+
+                shard.bytes = 0;
+            }
+        }
+
+        /**
+         * Return the number of bytes held by the cache, counting both keys and fragments.
+         */
+        size_t Size() const
+        {
+            return m_bytes;
+        }
+
+        /**
+         * Return the number of fragments held by the cache, including any that have expired but not been removed.
+         */
+        size_t Count() const
+        {
+            size_t count = 0;
+
+            for (const auto& shard : m_shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                count += shard.entries.size();
+            }
+
+            return count;
+        }
+
+    private:
+        struct Entry
+        {
+            std::string                           key;
+            std::shared_ptr<const std::string>    bytes;
+            std::chrono::steady_clock::time_point expires;
+        };
+
+        struct Shard
+        {
+            mutable std::mutex mutex;
+
+            // the fragments of the shard, from the most to the least recently used
+            std::list<Entry> entries;
+
+            std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+            size_t bytes = 0;
+        };
+
+        size_t ShardIndex(const std::string& key) const
+        {
+            return fnv1a_hash(key) % m_shards.size();
+        }
+
+        Shard& ShardFor(const std::string& key)
+        {
+            return m_shards[this->ShardIndex(key)];
+        }
+
+        bool Expired(const Entry& entry) const
+        {
+            return m_timeToLive.count() > 0 && std::chrono::steady_clock::now() >= entry.expires;
+        }
+
+        void EraseEntry(Shard& shard, std::unordered_map<std::string, std::list<Entry>::iterator>::iterator find)
+        {
+            const size_t cost = find->second->key.size() + find->second->bytes->size();
+
+            shard.bytes -= cost;
+
+            m_bytes -= cost;
+
+            shard.entries.erase(find->second);
+            shard.index.erase(find);
+        }
+
+        std::vector<Shard> m_shards;
+
+        size_t m_byteBudget;
+
+        // the bytes held by every shard together, which the budget applies to
+        std::atomic<size_t> m_bytes;
+
+        std::chrono::milliseconds m_timeToLive;
+    };
+
+    /**
+     * A struct for options for a ToString call on a Node or Document.
+     */
+    struct ToStringOptions
+    {
+        StringFormatting formatting;
+        bool trailingNewline;
+        uint32_t indentLevel;
+        bool escapeContent;
+        OutputEncoding encoding;
+
+        // the cache that nodes with a cache key are rendered through, if any
+        FragmentCache* cache;
+
+        ToStringOptions(
+            StringFormatting formatting=StringFormatting::SINGLE_LINE,
+            bool trailingNewLine=false,
+            uint32_t indentLevel=0,
+            bool escapeContent=true,
+            OutputEncoding encoding=OutputEncoding::UTF8,
+            FragmentCache* cache=nullptr)
+            : formatting(formatting)
+            , trailingNewline(trailingNewLine)
+            , indentLevel(indentLevel)
+            , escapeContent(escapeContent)
+            , encoding(encoding)
+            , cache(cache) {}
+    };
+
+    /**
+     * Build the key that a node with the cache key passed in is stored under in a fragment cache.
+     * 
+     * The same node renders differently with different options, so the options are part of the key.
+     */
+    inline std::string fragment_cache_key(const std::string& key, const ToStringOptions& options)
+    {
+        std::string output = key;
+
+        output += '\0';
+        output += static_cast<char>(options.formatting);
+        output += static_cast<char>(options.trailingNewline);
+        output += static_cast<char>(options.escapeContent);
+        output += static_cast<char>(options.encoding);
+        output += std::to_string(options.indentLevel);
+
+        return output;
+    }
+
+    /**
+     * A struct for selector tokens from parsing a selector.
+     */
+    struct SelectorToken
+    {
+        SelectorTokenType       type       = SelectorTokenType::ELEMENT;
+        std::string             value      = "";
+        AttributeComparisonType comparison = AttributeComparisonType::NONE;
+
+        SelectorToken(
+            SelectorTokenType type=SelectorTokenType::ELEMENT,
+            std::string value="",
+            AttributeComparisonType comparison=AttributeComparisonType::NONE)
+            : type(type)
+            , value(value)
+            , comparison(comparison) {}
+    };
+
+    /**
+     * Adds a single selector token to the token vector passed in based on the
+     * state of the parser that was passed.
+     */
+    inline void add_selector_token(
+        std::vector<SelectorToken>& tokens,
+        SelectorParserState state,
+        const std::string& value)
+    {
+        switch (state)
+        {
+            case SelectorParserState::ELEMENT:
+                tokens.push_back({ SelectorTokenType::ELEMENT, value });
+                break;
+            case SelectorParserState::CLASS:
+                tokens.push_back({ SelectorTokenType::CLASS, value });
+                break;
+            case SelectorParserState::ID:
+                tokens.push_back({ SelectorTokenType::ID, value });
+                break;
+            case SelectorParserState::ATTRIBUTE_NAME:
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_NAME, value });
+                break;
+            case SelectorParserState::ATTRIBUTE_VALUE:
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_VALUE, value });
+                break;
+            // do nothing for any other type as we can't determine a token
+            case SelectorParserState::NONE:
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Adds a combinator token to the token vector passed in.
+     * 
+     * Combinators may be surrounded by spaces, so this collapses a combinator with any separator token that came before
+     * it, and ignores separators that come directly after another combinator.
+     */
+    inline void add_selector_combinator(std::vector<SelectorToken>& tokens, SelectorTokenType type)
+    {
+        if (!tokens.empty())
+        {
+            SelectorTokenType last = tokens.back().type;
+
+            // nothing can combine with the start of a selector in a list
+            if (last == SelectorTokenType::SELECTOR_LIST && type != SelectorTokenType::SELECTOR_LIST)
+            {
+                return;
+            }
+
+            if (last == SelectorTokenType::SELECTOR_CHILD ||
+                last == SelectorTokenType::SELECTOR_SIBLING ||
+                last == SelectorTokenType::SELECTOR_GENERAL_SIBLING)
+            {
+                // the end of a selector in a list drops any combinator left dangling before it
+                if (type == SelectorTokenType::SELECTOR_LIST)
+                    tokens.back().type = type;
+
+                return;
+            }
+
+            if (last == SelectorTokenType::SELECTOR_SEPARATOR)
+            {
+                // a space followed by an explicit combinator is just that combinator
+                if (type != SelectorTokenType::SELECTOR_SEPARATOR)
+                    tokens.back().type = type;
+
+                return;
+            }
+        }
+        // a selector list can not start with an empty selector
+        else if (type == SelectorTokenType::SELECTOR_LIST)
+        {
+            return;
+        }
+
+        tokens.push_back({ type, "" });
+    }
+
+    /**
+     * Grabs the character that is one ahead of the index passed in.
+     * 
+     * Used as a convenience method for selector parsing to get a lookahead while also doing bounds checking.
+     * 
+     * Returns either the character that is at the position one ahead of the index, or a null char.
+     */
+    inline const char get_lookahead_char(const std::string& selector, size_t index)
+    {
+        if (selector.size() <= index + 1)
+        {
+            return '\0';
+        }
+
+        return selector.at(index + 1);
+    }
+
+    /**
+     * Parses a string representation of a CSS selector into a vector of tokens.
+     * 
+     * This parser isn't meant to be comprehensive and robust, just merely to
+     * allow searching for elements via common selectors and to parse Emmet-like
+     * abbriviations for use in creating nodes.
+     * 
+     * This parser particularly just scans the string from start to finish
+     * character by character, and thus might be slow on very large strings
+     * or very complex selectors.
+     * 
+     * Pseudo-classes are only parsed for searches, as a colon in the name of
+     * a node being built is part of the name, such as in `svg:path`.
+     */
+    inline std::vector<SelectorToken> parse_selector(const std::string& selector, bool pseudoClasses=true)
+    {
+        std::vector<SelectorToken> tokens;
+
+        // start the parser to be parsing an element by default
+        SelectorParserState state = SelectorParserState::ELEMENT;
+
+        std::string temp = "";
+
+        // whether to skip the following character in the selector, used for attribute matching parsing when we perform
+        // a lookahead for the equal sign on a character, if the following character is an equal sign, then we skip it
+        bool skipNext = false;
+
+        for (size_t index = 0; index < selector.size(); index++)
+        {
+            const char& current = selector.at(index);
+
+            if (skipNext)
+            {
+                skipNext = false;
+
+                continue;
+            }
+
+            if (current == '.' && state != SelectorParserState::ATTRIBUTE_VALUE)
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                temp = "";
+
+                state = SelectorParserState::CLASS;
+
+                continue;
+            }
+            else if (current == '#' && state != SelectorParserState::ATTRIBUTE_VALUE)
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                temp = "";
+
+                state = SelectorParserState::ID;
+
+                continue;
+            }
+            // only treat spaces as a split character if we aren't parsing attributes
+            // as these attribute strings are allowed to have spaces
+            else if (current == ' ' && state != SelectorParserState::ATTRIBUTE_VALUE)
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token to the token vector that signifies a split
+                add_selector_combinator(tokens, SelectorTokenType::SELECTOR_SEPARATOR);
+
+                temp = "";
+
+                state = SelectorParserState::ELEMENT;
+
+                continue;
+            }
+            else if (
+                (current == '>' || current == '+' || current == '~') &&
+                state != SelectorParserState::ATTRIBUTE_NAME &&
+                state != SelectorParserState::ATTRIBUTE_VALUE
+            )
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                SelectorTokenType combinator = SelectorTokenType::SELECTOR_CHILD;
+
+                if (current == '+')
+                    combinator = SelectorTokenType::SELECTOR_SIBLING;
+                else if (current == '~')
+                    combinator = SelectorTokenType::SELECTOR_GENERAL_SIBLING;
+
+                add_selector_combinator(tokens, combinator);
+
+                temp = "";
+
+                state = SelectorParserState::ELEMENT;
+
+                continue;
+            }
+            // a comma splits a selector list, unless it is part of an attribute
+            else if (
+                current == ',' &&
+                state != SelectorParserState::ATTRIBUTE_NAME &&
+                state != SelectorParserState::ATTRIBUTE_VALUE
+            )
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                add_selector_combinator(tokens, SelectorTokenType::SELECTOR_LIST);
+
+                temp = "";
+
+                state = SelectorParserState::ELEMENT;
+
+                continue;
+            }
+            // the name of a pseudo-class and its argument are kept in one token, as the argument can hold characters
+            // that would otherwise be parsed, such as the `+` in `:nth-child(2n+1)`
+            else if (
+                pseudoClasses &&
+                current == ':' &&
+                state != SelectorParserState::ATTRIBUTE_NAME &&
+                state != SelectorParserState::ATTRIBUTE_VALUE
+            )
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                temp = "";
+
+                size_t depth = 0;
+
+                while (index + 1 < selector.size())
+                {
+                    const char next = selector.at(index + 1);
+
+                    if (depth == 0 && std::string(".#[ >+~,:").find(next) != std::string::npos)
+                        break;
+
+                    if (next == '(')
+                        depth++;
+                    else if (next == ')' && depth > 0)
+                        depth--;
+
+                    temp += next;
+
+                    index++;
+
+                    if (next == ')' && depth == 0)
+                        break;
+                }
+
+                tokens.push_back({ SelectorTokenType::PSEUDO_CLASS, temp });
+
+                temp = "";
+
+                state = SelectorParserState::NONE;
+
+                continue;
+            }
+            // an Emmet multiplier is a star followed directly by a count, a lone star is left alone
+            else if (
+                current == '*' &&
+                state != SelectorParserState::ATTRIBUTE_NAME &&
+                state != SelectorParserState::ATTRIBUTE_VALUE &&
+                std::isdigit(static_cast<unsigned char>(get_lookahead_char(selector, index)))
+            )
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                temp = "";
+
+                while (std::isdigit(static_cast<unsigned char>(get_lookahead_char(selector, index))))
+                {
+                    temp += selector.at(index + 1);
+
+                    index++;
+                }
+
+                tokens.push_back({ SelectorTokenType::MULTIPLIER, temp });
+
+                temp = "";
+
+                state = SelectorParserState::NONE;
+
+                continue;
+            }
+            else if (current == '[' && state != SelectorParserState::ATTRIBUTE_VALUE)
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_NAME;
+
+                continue;
+            }
+            else if (current == '~' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token for selector match equal
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "~=", AttributeComparisonType::ATTRIBUTE_CONTAINS_WORD });
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_VALUE;
+
+                skipNext = true;
+
+                continue;
+            }
+            else if (current == '|' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token for selector match equal
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "|=", AttributeComparisonType::ATTRIBUTE_IS_OR_BEGIN_HYPHEN });
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_VALUE;
+
+                skipNext = true;
+
+                continue;
+            }
+            else if (current == '^' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token for selector match equal
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "^=", AttributeComparisonType::ATTRIBUTE_STARTS_WITH });
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_VALUE;
+
+                skipNext = true;
+
+                continue;
+            }
+            else if (current == '$' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token for selector match equal
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "$=", AttributeComparisonType::ATTRIBUTE_ENDS_WITH });
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_VALUE;
+
+                skipNext = true;
+
+                continue;
+            }
+            else if (current == '*' && state == SelectorParserState::ATTRIBUTE_NAME && get_lookahead_char(selector, index) == '=')
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token for selector match equal
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "*=", AttributeComparisonType::ATTRIBUTE_CONTAINS });
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_VALUE;
+
+                skipNext = true;
+
+                continue;
+            }
+            else if (current == '=' && state == SelectorParserState::ATTRIBUTE_NAME)
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                // add an extra token for selector match equal
+                tokens.push_back({ SelectorTokenType::ATTRIBUTE_COMPARE, "=", AttributeComparisonType::ATTRIBUTE_EQUAL });
+
+                temp = "";
+
+                state = SelectorParserState::ATTRIBUTE_VALUE;
+
+                continue;
+            }
+            // ignore quotes for attribute values as they aren't necessary for
+            // the value of the attribute
+            else if (current == '"' && state == SelectorParserState::ATTRIBUTE_VALUE)
+            {
+                continue;
+            }
+            // ignore right square brackets if we are parsing an attribute name
+            // or an attribute value
+            else if (
+                current == ']' &&
+                (state == SelectorParserState::ATTRIBUTE_NAME ||
+                 state == SelectorParserState::ATTRIBUTE_VALUE)
+            )
+            {
+                if (!temp.empty())
+                    add_selector_token(tokens, state, temp);
+
+                temp = "";
+
+                state = SelectorParserState::NONE;
+
+                continue;
+            }
+
+            temp += current;
+        }
+
+        // if we still have a temporary value parsed, just add it to the tokens
+        if (!temp.empty())
+            add_selector_token(tokens, state, temp);
+
+        return tokens;
+    }
+
+    using SelectorTokenItr = std::vector<SelectorToken>::iterator;
+
+    /**
+     * A single attribute test from a compiled selector, such as `[data-test^="value"]`.
+     * 
+     * A comparison of NONE only checks that the attribute is set.
+     */
+    struct AttributeSelector
+    {
+        std::string             name;
+        AttributeComparisonType comparison = AttributeComparisonType::NONE;
+        std::string             value;
+    };
+
+    struct CompiledSelector;
+
+    /**
+     * A single pseudo-class test from a compiled selector, such as `:nth-child(2n+1)` or `:not(.hidden)`.
+     * 
+     * The positional pseudo-classes match an element at any position of the form `a * n + b`, for any n of zero or above,
+     * counting from one.
+     */
+    struct PseudoClassSelector
+    {
+        PseudoClassType type = PseudoClassType::UNKNOWN;
+
+        int a = 0;
+        int b = 0;
+
+        // the selector list inside a `:not()`
+        std::vector<CompiledSelector> selectors;
+    };
+
+    /**
+     * A compound selector, which holds every test that applies to a single element, such as `div.item#main[title]`.
+     */
+    struct CompoundSelector
+    {
+        // the combinator that joins this compound to the one before it, unused for the first compound
+        SelectorTokenType combinator = SelectorTokenType::SELECTOR_SEPARATOR;
+
+        // an empty element name, or `*`, matches any element
+        std::string element;
+        std::string id;
+
+        std::vector<std::string> classes;
+
+        // the class mask bits of every class above, see class_mask_bit
+        uint64_t classMask = 0;
+
+        std::vector<AttributeSelector> attributes;
+
+        std::vector<PseudoClassSelector> pseudoClasses;
+    };
+
+    /**
+     * A selector compiled from its tokens into compound selectors, ordered from left to right.
+     * 
+     * Elements are matched against the rightmost compound first, and only then are the compounds before it checked
+     * against the ancestors of the element, so most elements are rejected without looking at any other node.
+     */
+    struct CompiledSelector
+    {
+        std::vector<CompoundSelector> compounds;
+
+        // the ancestor filter hashes of every element name, id, and class that an ancestor of a match must have
+        std::vector<uint64_t> ancestorHashes;
+    };
+
+    inline std::vector<CompiledSelector> compile_selector_list(const std::string& selector);
+
+    /**
+     * Parses an integer with an optional sign, such as `3`, `+3` or `-3`, which has to be the whole of the value.
+     * 
+     * Returns false if the value is not such an integer, or is out of range.
+     */
+    inline bool parse_nth_integer(const std::string& value, int& result)
+    {
+        size_t digits = (!value.empty() && (value[0] == '+' || value[0] == '-')) ? 1 : 0;
+
+        if (digits == value.size() || value.find_first_not_of("0123456789", digits) != std::string::npos)
+            return false;
+
+        try
+        {
+            size_t used = 0;
+
+            result = std::stoi(value, &used);
+
+            return used == value.size();
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+    /**
+     * Parses the `an+b` argument of a positional pseudo-class, such as `2n+1`, `-n+3`, `4`, `odd` or `even`.
+     * 
+     * Whitespace is allowed around the argument and on either side of the sign of the offset, as in `2n + 1`, but
+     * nowhere else, and the offset needs a sign when there is a step. Returns false if the argument could not be parsed.
+     */
+    inline bool parse_nth_argument(const std::string& argument, int& a, int& b)
+    {
+        const char* whitespace = " \t\n\r\f";
+
+        size_t first = argument.find_first_not_of(whitespace);
+
+        if (first == std::string::npos)
+            return false;
+
+        std::string value = argument.substr(first, argument.find_last_not_of(whitespace) - first + 1);
+
+        for (char& character : value)
+            character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+
+        if (value == "odd")
+            value = "2n+1";
+        else if (value == "even")
+            value = "2n";
+
+        size_t n = value.find('n');
+
+        if (n == std::string::npos)
+        {
+            a = 0;
+
+            return parse_nth_integer(value, b);
+        }
+
+        std::string step = value.substr(0, n);
+
+        // a bare `n` has a step of one, including when it only has a sign
+        if (step.empty() || step == "+")
+            a = 1;
+        else if (step == "-")
+            a = -1;
+        else if (!parse_nth_integer(step, a))
+            return false;
+
+        size_t sign = value.find_first_not_of(whitespace, n + 1);
+
+        if (sign == std::string::npos)
+        {
+            b = 0;
+
+            return true;
+        }
+
+        if (value[sign] != '+' && value[sign] != '-')
+            return false;
+
+        size_t digits = value.find_first_not_of(whitespace, sign + 1);
+
+        // the sign was already read, so the digits after it may not have another one
+        if (digits == std::string::npos || !std::isdigit(static_cast<unsigned char>(value[digits])))
+            return false;
+
+        return parse_nth_integer(value[sign] + value.substr(digits), b);
+    }
+
+    /**
+     * Compiles the value of a pseudo-class token, such as `first-child` or `nth-child(2n+1)`.
+     * 
+     * Pseudo-classes that are not supported, or that have an argument that can not be parsed, never match.
+     */
+    inline PseudoClassSelector compile_pseudo_class(const std::string& value)
+    {
+        PseudoClassSelector pseudoClass;
+
+        size_t open = value.find('(');
+
+        std::string name     = value.substr(0, open);
+        std::string argument = "";
+
+        if (open != std::string::npos)
+        {
+            size_t close = value.rfind(')');
+
+            argument = value.substr(open + 1, (close == std::string::npos || close < open) ? std::string::npos : close - open - 1);
+        }
+
+        if (name == "first-child" && open == std::string::npos)
+            pseudoClass.type = PseudoClassType::FIRST_CHILD;
+        else if (name == "last-child" && open == std::string::npos)
+            pseudoClass.type = PseudoClassType::LAST_CHILD;
+        else if (name == "empty" && open == std::string::npos)
+            pseudoClass.type = PseudoClassType::EMPTY;
+        else if (name == "nth-child" && parse_nth_argument(argument, pseudoClass.a, pseudoClass.b))
+            pseudoClass.type = PseudoClassType::NTH_CHILD;
+        else if (name == "nth-of-type" && parse_nth_argument(argument, pseudoClass.a, pseudoClass.b))
+            pseudoClass.type = PseudoClassType::NTH_OF_TYPE;
+        else if (name == "not" && open != std::string::npos)
+        {
+            pseudoClass.type      = PseudoClassType::NOT;
+            pseudoClass.selectors = compile_selector_list(argument);
+        }
+
+        return pseudoClass;
+    }
+
+    /**
+     * Checks if a position, counting from one, is of the form `a * n + b` for any n of zero or above.
+     */
+    inline bool nth_position_matches(int a, int b, size_t position)
+    {
+        int difference = static_cast<int>(position) - b;
+
+        if (a == 0)
+            return difference == 0;
+
+        return (difference / a) >= 0 && (difference % a) == 0;
+    }
+
+    /**
+     * Compiles a string representation of a CSS selector list, such as `h1, h2.title`, for matching against nodes.
+     * 
+     * Each selector in the list is compiled on its own, and empty selectors are left out.
+     */
+    inline std::vector<CompiledSelector> compile_selector_list(const std::string& selector)
+    {
+        std::vector<SelectorToken> tokens = parse_selector(selector);
+
+        std::vector<CompiledSelector> compiled(1);
+
+        // compounds are only started once a test for them is found, so a leading or trailing combinator is ignored
+        bool startCompound = true;
+
+        SelectorTokenType combinator = SelectorTokenType::SELECTOR_SEPARATOR;
+
+        for (const auto& token : tokens)
+        {
+            if (token.type == SelectorTokenType::SELECTOR_LIST)
+            {
+                if (!compiled.back().compounds.empty())
+                    compiled.push_back(CompiledSelector());
+
+                startCompound = true;
+
+                continue;
+            }
+
+            if (token.type == SelectorTokenType::SELECTOR_SEPARATOR ||
+                token.type == SelectorTokenType::SELECTOR_CHILD ||
+                token.type == SelectorTokenType::SELECTOR_SIBLING ||
+                token.type == SelectorTokenType::SELECTOR_GENERAL_SIBLING)
+            {
+                combinator    = token.type;
+                startCompound = true;
+
+                continue;
+            }
+
+            // multipliers only have a meaning for construction
+            if (token.type == SelectorTokenType::MULTIPLIER)
+                continue;
+
+            std::vector<CompoundSelector>& compounds = compiled.back().compounds;
+
+            if (startCompound)
+            {
+                compounds.push_back(CompoundSelector());
+
+                compounds.back().combinator = combinator;
+
+                startCompound = false;
+            }
+
+            CompoundSelector& compound = compounds.back();
+
+            switch (token.type)
+            {
+                case SelectorTokenType::ELEMENT:
+                    compound.element = token.value;
+                    break;
+                case SelectorTokenType::CLASS:
+                    compound.classes.push_back(token.value);
+                    compound.classMask |= class_mask_bit(token.value);
+                    break;
+                case SelectorTokenType::ID:
+                    compound.id = token.value;
+                    break;
+                case SelectorTokenType::ATTRIBUTE_NAME:
+                    compound.attributes.push_back(AttributeSelector());
+                    compound.attributes.back().name = token.value;
+                    break;
+                case SelectorTokenType::ATTRIBUTE_COMPARE:
+                    if (!compound.attributes.empty())
+                        compound.attributes.back().comparison = token.comparison;
+                    break;
+                case SelectorTokenType::ATTRIBUTE_VALUE:
+                    if (!compound.attributes.empty())
+                        compound.attributes.back().value = token.value;
+                    break;
+                case SelectorTokenType::PSEUDO_CLASS:
+                    compound.pseudoClasses.push_back(compile_pseudo_class(token.value));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (compiled.back().compounds.empty())
+            compiled.pop_back();
+
+        for (auto& selector : compiled)
+        {
+            // a compound directly to the left of a descendant or child combinator matches an ancestor of the compound
+            // to its right, which is always an ancestor of a match too, as siblings share the same ancestors
+            for (size_t index = selector.compounds.size(); index-- > 1;)
+            {
+                const CompoundSelector& right = selector.compounds[index];
+
+                if (right.combinator != SelectorTokenType::SELECTOR_SEPARATOR &&
+                    right.combinator != SelectorTokenType::SELECTOR_CHILD)
+                {
+                    continue;
+                }
+
+                const CompoundSelector& compound = selector.compounds[index - 1];
+
+                if (!compound.element.empty() && compound.element != "*")
+                    selector.ancestorHashes.push_back(ancestor_filter_hash('<', compound.element));
+
+                if (!compound.id.empty())
+                    selector.ancestorHashes.push_back(ancestor_filter_hash('#', compound.id));
+
+                for (const auto& className : compound.classes)
+                    selector.ancestorHashes.push_back(ancestor_filter_hash('.', className));
+            }
+        }
+
+        return compiled;
+    }
+
+    /**
+     * A set of compiled selectors that are searched for together in a single traversal.
+     * 
+     * Selectors are bucketed by the most specific test in their rightmost compound, whether that is an id, a class,
+     * or an element name, so each element only has to be checked against the selectors that could possibly match
+     * it, rather than every selector in the batch.
+     */
+    struct SelectorBatch
+    {
+        std::vector<CompiledSelector> selectors;
+
+        // the index of the source selector each compiled selector came from, which its matches are added to
+        std::vector<size_t> targets;
+
+        std::unordered_map<std::string, std::vector<size_t>> byId;
+        std::unordered_map<std::string, std::vector<size_t>> byClass;
+        std::unordered_map<std::string, std::vector<size_t>> byElement;
+
+        // selectors that have nothing to bucket by, which are checked against every element
+        std::vector<size_t> universal;
+
+        explicit SelectorBatch(const std::vector<std::string>& sources)
+        {
+            for (size_t source = 0; source < sources.size(); source++)
+            {
+                for (auto& selector : compile_selector_list(sources[source]))
+                {
+                    selectors.push_back(std::move(selector));
+                    targets.push_back(source);
+                }
+            }
+
+            for (size_t index = 0; index < selectors.size(); index++)
+            {
+                const CompoundSelector& last = selectors[index].compounds.back();
+
+                if (!last.id.empty())
+                    byId[last.id].push_back(index);
+                else if (!last.classes.empty())
+                    byClass[last.classes.front()].push_back(index);
+                else if (!last.element.empty() && last.element != "*")
+                    byElement[last.element].push_back(index);
+                else
+                    universal.push_back(index);
+
+                if (!selectors[index].ancestorHashes.empty())
+                    filterAncestors = true;
+            }
+        }
+
+        // whether any selector needs the ancestor filter, which is only kept up to date during a search if so
+        bool filterAncestors = false;
+    };
+
+    /**
+     * A counting Bloom filter of the element names, ids, and classes of the ancestors on the path of a selector search.
+     * 
+     * Before walking up the tree to match the compounds to the left of a descendant or child combinator, the filter is
+     * checked for every value those compounds require. If any value is definitely missing from the ancestors, the
+     * element is rejected straight away, which keeps deep descendant searches close to linear on large documents.
+     * 
+     * Each value sets two of the counters, and a counter that fills up stays full, so the filter can only ever
+     * report a value that is missing as present, never the other way around.
+     */
+    class AncestorFilter
+    {
+    public:
+        /**
+         * Add a value hashed with ancestor_filter_hash to the filter.
+         */
+        void Add(uint64_t hash)
+        {
+            this->Increment(hash & MASK);
+            this->Increment((hash >> 32) & MASK);
+        }
+
+        /**
+         * Remove a value that was added before from the filter.
+         */
+        void Remove(uint64_t hash)
+        {
+            this->Decrement(hash & MASK);
+            this->Decrement((hash >> 32) & MASK);
+        }
+
+        /**
+         * Check if the filter may have every value passed in, returning false if any of them is definitely missing.
+         */
+        bool MayContainAll(const std::vector<uint64_t>& hashes) const
+        {
+            for (uint64_t hash : hashes)
+            {
+                if (m_counters[hash & MASK] == 0 || m_counters[(hash >> 32) & MASK] == 0)
+                    return false;
+            }
+
+            return true;
+        }
+
+    private:
+        static const size_t SIZE = 1024;
+        static const size_t MASK = SIZE - 1;
+
+        void Increment(uint64_t index)
+        {
+            if (m_counters[index] != UINT8_MAX)
+                m_counters[index]++;
+        }
+
+        void Decrement(uint64_t index)
+        {
+            if (m_counters[index] != UINT8_MAX && m_counters[index] != 0)
+                m_counters[index]--;
+        }
+
+        uint8_t m_counters[SIZE] = {};
+    };
+
+    /**
+     * Structure used when expanding an Emmet-like abbreviation into nodes.
+     * 
+     * Each segment references the tokens for a single element, how many times that element is repeated, and the
+     * combinator that links it to the segment that follows.
+     */
+    struct AbbreviationSegment
+    {
+        /**
+         * The largest number of times a single element can be repeated, as each repeat is built in memory.
+         */
+        static const size_t MAX_MULTIPLIER = 10000;
+
+        /**
+         * The largest number of nodes a whole abbreviation expands into, as nested multipliers multiply each other.
+         */
+        static const size_t MAX_NODES = 100000;
+
+        SelectorTokenItr  begin;
+        SelectorTokenItr  end;
+        size_t            multiplier = 1;
+        SelectorTokenType combinator = SelectorTokenType::SELECTOR_SEPARATOR;
+
+        AbbreviationSegment() = default;
+
+        AbbreviationSegment(SelectorTokenItr begin, SelectorTokenItr end)
+            : begin(begin)
+            , end(end) {}
+    };
+
+    /**
+     * Parses the count of an Emmet `*N` multiplier, which is at least one, and clamped to the maximum multiplier
+     * rather than overflowing for counts that are too large.
+     */
+    inline size_t parse_abbreviation_multiplier(const std::string& value)
+    {
+        size_t multiplier = 0;
+
+        for (char digit : value)
+        {
+            if (!std::isdigit(static_cast<unsigned char>(digit)))
+                break;
+
+            multiplier = multiplier * 10 + static_cast<size_t>(digit - '0');
+
+            if (multiplier >= AbbreviationSegment::MAX_MULTIPLIER)
+                return AbbreviationSegment::MAX_MULTIPLIER;
+        }
+
+        return std::max<size_t>(1, multiplier);
+    }
+
+    /**
+     * Replaces each run of `$` characters in an abbreviation value with the number passed in, zero padded to the
+     * length of the run, so `item$$` with a number of 3 becomes `item03`.
+     */
+    inline std::string number_abbreviation_value(const std::string& value, size_t number)
+    {
+        size_t start = value.find('$');
+
+        if (start == std::string::npos)
+        {
+            return value;
+        }
+
+        std::string output = value.substr(0, start);
+        std::string digits = std::to_string(number);
+
+        for (size_t index = start; index < value.size(); index++)
+        {
+            if (value[index] != '$')
+            {
+                output += value[index];
+
+                continue;
+            }
+
+            size_t run = 0;
+
+            while (index < value.size() && value[index] == '$')
+            {
+                run++;
+                index++;
+            }
+
+            // step back so the loop increment lands on the character after the run
+            index--;
+
+            if (digits.size() < run)
+                output.append(run - digits.size(), '0');
+
+            output += digits;
+        }
+
+        return output;
+    }
+
+    /**
+     * A vector that stores up to a fixed number of elements inline, only allocating on the heap once it grows past
+     * that number.
+     * 
+     * Used for per-node lists that are almost always short, such as attributes, so that the common case needs no
+     * allocation for the list itself.
+     */
+    template <typename T, size_t InlineCapacity>
+    class SmallVector
+    {
+    public:
+        using iterator       = T*;
+        using const_iterator = const T*;
+
+        SmallVector()
+            : m_data(this->InlineData()) {}
+
+        SmallVector(const SmallVector& other)
+            : m_data(this->InlineData())
+        {
+            this->reserve(other.m_size);
+
+            for (const auto& element : other)
+                this->emplace_back(element);
+        }
+
+        SmallVector(SmallVector&& other) noexcept
+            : m_data(this->InlineData())
+        {
+            this->TakeFrom(other);
+        }
+
+        ~SmallVector()
+        {
+            this->clear();
+            this->FreeHeap();
+        }
+
+        SmallVector& operator=(const SmallVector& other)
+        {
+            if (this != &other)
+            {
+                this->clear();
+                this->reserve(other.m_size);
+
+                for (const auto& element : other)
+                    this->emplace_back(element);
+            }
+
+            return *this;
+        }
+
+        SmallVector& operator=(SmallVector&& other) noexcept
+        {
+            if (this != &other)
+            {
+                this->clear();
+                this->FreeHeap();
+                this->TakeFrom(other);
+            }
+
+            return *this;
+        }
+
+        iterator begin()
+        {
+            return m_data;
+        }
+
+        iterator end()
+        {
+            return m_data + m_size;
+        }
+
+        const_iterator begin() const
+        {
+            return m_data;
+        }
+
+        const_iterator end() const
+        {
+            return m_data + m_size;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        T& operator[](size_t index)
+        {
+            return m_data[index];
+        }
+
+        const T& operator[](size_t index) const
+        {
+            return m_data[index];
+        }
+
+        T& back()
+        {
+            return m_data[m_size - 1];
+        }
+
+        void reserve(size_t capacity)
+        {
+            if (capacity > m_capacity)
+                this->Grow(capacity);
+        }
+
+        template <typename... Args>
+        T& emplace_back(Args&&... args)
+        {
+            if (m_size == m_capacity)
+            {
+                // construct before growing, as the arguments may refer to an element that is about to move
+                T element(std::forward<Args>(args)...);
+
+                this->Grow(m_capacity * 2);
+
+                new (m_data + m_size) T(std::move(element));
+            }
+            else
+            {
+                new (m_data + m_size) T(std::forward<Args>(args)...);
+            }
+
+            return m_data[m_size++];
+        }
+
+        void push_back(const T& element)
+        {
+            this->emplace_back(element);
+        }
+
+        void push_back(T&& element)
+        {
+            this->emplace_back(std::move(element));
+        }
+
+        iterator erase(iterator position)
+        {
+            std::move(position + 1, this->end(), position);
+
+            m_data[--m_size].~T();
+
+            return position;
+        }
+
+        void clear()
+        {
+            for (size_t index = 0; index < m_size; index++)
+                m_data[index].~T();
+
+            m_size = 0;
+        }
+
+    private:
+        T* InlineData()
+        {
+            return reinterpret_cast<T*>(&m_inline[0]);
+        }
+
+        void Grow(size_t capacity)
+        {
+            T* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+
+            for (size_t index = 0; index < m_size; index++)
+            {
+                new (data + index) T(std::move(m_data[index]));
+
+                m_data[index].~T();
+            }
+
+            this->FreeHeap();
+
+            m_data     = data;
+            m_capacity = capacity;
+        }
+
+        void FreeHeap()
+        {
+            if (m_data != this->InlineData())
+                ::operator delete(m_data);
+
+            m_data     = this->InlineData();
+            m_capacity = InlineCapacity;
+        }
+
+        /**
+         * Take the elements of another vector, which must be empty with no heap storage beforehand.
+         */
+        void TakeFrom(SmallVector& other)
+        {
+            if (other.m_data != other.InlineData())
+            {
+                m_data     = other.m_data;
+                m_size     = other.m_size;
+                m_capacity = other.m_capacity;
+
+                other.m_data     = other.InlineData();
+                other.m_size     = 0;
+                other.m_capacity = InlineCapacity;
+
+                return;
+            }
+
+            for (auto& element : other)
+                new (m_data + m_size++) T(std::move(element));
+
+            other.clear();
+        }
+
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type m_inline[InlineCapacity];
+
+        T*     m_data;
+        size_t m_size     = 0;
+        size_t m_capacity = InlineCapacity;
+    };
+
+    /**
+     * A single attribute name and value for an element.
+     */
+    struct Attribute
+    {
+        std::string name;
+        std::string value;
+
+        // the value escaped for output, left empty when escaping would not change the value
+        std::string escaped;
+
+        // the context that the value is escaped for
+        EscapeContext context;
+
+        // the name of the template slot that fills in the value, if the value is left to a template
+        std::string slot;
+
+        Attribute(std::string name, std::string value, EscapeContext context=EscapeContext::HTML)
+            : name(std::move(name))
+            , value(std::move(value))
+            , context(context)
+        {
+            this->Escape();
+        }
+
+        /**
+         * Escape the value for output, so that rendering only has to copy it.
+         * 
+         * This must be called whenever the value or context is changed.
+         */
+        void Escape()
+        {
+            escaped = escape_value(value, context);
+
+            if (escaped == value)
+                escaped.clear();
+        }
+
+        /**
+         * Get the value as it should be output.
+         */
+        const std::string& Output() const
+        {
+            return escaped.empty() ? value : escaped;
+        }
+    };
+
+    /**
+     * Orders attributes by their names, for hashing them in the same order whatever order they were set in.
+     */
+    inline bool compare_attribute_names(const Attribute* left, const Attribute* right)
+    {
+        return left->name < right->name;
+    }
+
+    /**
+     * The attributes of an element, kept in the order that they were first set.
+     * 
+     * Most elements have only a few attributes, so the first three are stored inline and looked up with a linear scan.
+     * Once a list grows past the index threshold, a hash index of names is kept alongside it for lookups.
+     */
+    class AttributeList
+    {
+    public:
+        using const_iterator = const Attribute*;
+
+        /**
+         * The number of attributes after which lookups go through a hash index.
+         */
+        static const size_t INDEX_THRESHOLD = 8;
+
+        AttributeList() = default;
+
+        AttributeList(const AttributeList& other)
+            : m_attributes(other.m_attributes)
+        {
+            this->RebuildIndex();
+        }
+
+        AttributeList(AttributeList&& other) = default;
+
+        AttributeList& operator=(const AttributeList& other)
+        {
+            m_attributes = other.m_attributes;
+
+            this->RebuildIndex();
+
+            return *this;
+        }
+
+        AttributeList& operator=(AttributeList&& other) = default;
+
+        const_iterator begin() const
+        {
+            return m_attributes.begin();
+        }
+
+        const_iterator end() const
+        {
+            return m_attributes.end();
+        }
+
+        size_t size() const
+        {
+            return m_attributes.size();
+        }
+
+        bool empty() const
+        {
+            return m_attributes.empty();
+        }
+
+        /**
+         * Return the value of an attribute, or null if it is not set.
+         */
+        const std::string* Find(const std::string& name) const
+        {
+            size_t index = this->IndexOf(name);
+
+            return (index != std::string::npos) ? &m_attributes[index].value : nullptr;
+        }
+
+        /**
+         * Return an attribute along with its context and slot, or null if it is not set.
+         */
+        const Attribute* Get(const std::string& name) const
+        {
+            size_t index = this->IndexOf(name);
+
+            return (index != std::string::npos) ? &m_attributes[index] : nullptr;
+        }
+
+        /**
+         * Set the value of an attribute, keeping its position if it was already set.
+         */
+        void Set(const std::string& name, std::string value, EscapeContext context=EscapeContext::HTML)
+        {
+            size_t index = this->IndexOf(name);
+
+            if (index != std::string::npos)
+            {
+                m_attributes[index].value   = std::move(value);
+                m_attributes[index].context = context;
+
+                m_attributes[index].slot.clear();
+                m_attributes[index].Escape();
+
+                return;
+            }
+
+            m_attributes.emplace_back(name, std::move(value), context);
+
+            if (m_index)
+                (*m_index)[name] = m_attributes.size() - 1;
+            else if (m_attributes.size() > INDEX_THRESHOLD)
+                this->RebuildIndex();
+        }
+
+        /**
+         * Leave the value of an attribute to the template slot passed in, keeping its position if it was already set.
+         */
+        void SetSlot(const std::string& name, std::string slot, EscapeContext context=EscapeContext::HTML)
+        {
+            this->Set(name, "", context);
+
+            m_attributes[this->IndexOf(name)].slot = std::move(slot);
+        }
+
+        /**
+         * Remove an attribute, returning whether it was set.
+         */
+        bool Remove(const std::string& name)
+        {
+            size_t index = this->IndexOf(name);
+
+            if (index == std::string::npos)
+                return false;
+
+            m_attributes.erase(m_attributes.begin() + index);
+
+            this->RebuildIndex();
+
+            return true;
+        }
+
+    private:
+        size_t IndexOf(const std::string& name) const
+        {
+            if (m_index)
+            {
+                auto find = m_index->find(name);
+
+                return (find != m_index->end()) ? find->second : std::string::npos;
+            }
+
+            for (size_t index = 0; index < m_attributes.size(); index++)
+            {
+                if (m_attributes[index].name == name)
+                    return index;
+            }
+
+            return std::string::npos;
+        }
+
+        void RebuildIndex()
+        {
+            if (m_attributes.size() <= INDEX_THRESHOLD)
+            {
+                m_index.reset();
+
+                return;
+            }
+
+            m_index.reset(new std::unordered_map<std::string, size_t>());
+
+            for (size_t index = 0; index < m_attributes.size(); index++)
+                (*m_index)[m_attributes[index].name] = index;
+        }
+
+        SmallVector<Attribute, 3> m_attributes;
+
+        /**
+         * A hash index of names to positions, only kept past the threshold.
+         */
+        std::unique_ptr<std::unordered_map<std::string, size_t>> m_index;
+    };
+
+    class Template;
+
+    /**
+     * An enum for the kinds of slot that a template can have.
+     */
+    enum class TemplateSlotType : uint8_t
+    {
+        TEXT,      // Text content, escaped as text is
+        ATTRIBUTE, // The value of an attribute, escaped for the context of the attribute
+        LIST,      // A child template that is rendered once for each item in a list
+    };
+
+    /**
+     * A single slot in a compiled template, which is filled in with a value when the template is rendered.
+     */
+    struct TemplateSlot
+    {
+        TemplateSlotType type = TemplateSlotType::TEXT;
+        std::string      name;
+        EscapeContext    context = EscapeContext::HTML;
+
+        // the offset into the static bytes of the template where the value goes
+        size_t position = 0;
+
+        // the template for each item of a list slot
+        std::shared_ptr<const Template> item;
+    };
+
+    /**
+     * The values to fill in the slots of a template with, looked up by slot name.
+     */
+    class TemplateValues
+    {
+    public:
+        /**
+         * Set the value of a text or attribute slot.
+         */
+        TemplateValues& Set(const std::string& name, std::string value)
+        {
+            m_values[name] = std::move(value);
+
+            return *this;
+        }
+
+        /**
+         * Add an item to a list slot, returning the values for the slots of that item.
+         * 
+         * The reference returned is only valid until the next item is added to the same list.
+         */
+        TemplateValues& AddItem(const std::string& name)
+        {
+            std::vector<TemplateValues>& items = m_items[name];
+
+            items.push_back(TemplateValues());
+
+            return items.back();
+        }
+
+        /**
+         * Return the value of a text or attribute slot, or null if it is not set.
+         */
+        const std::string* Find(const std::string& name) const
+        {
+            auto find = m_values.find(name);
+
+            return (find != m_values.end()) ? &find->second : nullptr;
+        }
+
+        /**
+         * Return the items of a list slot, or null if none were added.
+         */
+        const std::vector<TemplateValues>* FindItems(const std::string& name) const
+        {
+            auto find = m_items.find(name);
+
+            return (find != m_items.end()) ? &find->second : nullptr;
+        }
+
+    private:
+        std::unordered_map<std::string, std::string> m_values;
+        std::unordered_map<std::string, std::vector<TemplateValues>> m_items;
+    };
+
+    /**
+     * A node tree compiled into a render plan, made with Node::Compile.
+     * 
+     * Everything in the tree but its slots is rendered when the template is compiled, so the plan is just the static
+     * bytes of the tree, along with the offsets in those bytes where each slot goes. Rendering the template copies the
+     * static bytes between the slots, and escapes and copies the value of each slot, without building any nodes.
+     * 
+     * Templates never change once compiled, so a template can be rendered from any number of threads at once.
+     */
+    class Template
+    {
+    public:
+        Template(std::string bytes, std::vector<TemplateSlot> slots, ToStringOptions options)
+            : m_bytes(std::move(bytes))
+            , m_slots(std::move(slots))
+            , m_options(options) {}
+
+        /**
+         * Render the template with the values passed in.
+         * 
+         * A slot without a value is left empty, and a list without items is left out.
+         */
+        std::string Render(const TemplateValues& values) const
+        {
+            std::string output;
+
+            output.reserve(m_bytes.size());
+
+            this->AppendRender(output, values);
+
+            return output;
+        }
+
+        /**
+         * Render the template with the values passed in to the end of the output passed in.
+         */
+        void AppendRender(std::string& output, const TemplateValues& values) const
+        {
+            size_t start = 0;
+
+            for (const auto& slot : m_slots)
+            {
+                output.append(m_bytes, start, slot.position - start);
+
+                start = slot.position;
+
+                if (slot.type == TemplateSlotType::LIST)
+                {
+                    const std::vector<TemplateValues>* items = values.FindItems(slot.name);
+
+                    if (items == nullptr)
+                        continue;
+
+                    for (const auto& item : *items)
+                        slot.item->AppendRender(output, item);
+
+                    continue;
+                }
+
+                const std::string* value = values.Find(slot.name);
+
+                if (value == nullptr)
+                    continue;
+
+                if (slot.type == TemplateSlotType::ATTRIBUTE)
+                    append_encoded(output, escape_value(*value, slot.context), m_options.encoding);
+                else if (m_options.escapeContent)
+                    append_encoded(output, html_escape(*value, false), m_options.encoding);
+                else
+                    append_encoded(output, *value, m_options.encoding);
+            }
+
+            output.append(m_bytes, start, std::string::npos);
+        }
+
+        /**
+         * Return the static bytes of the template, which is what the template renders to without any values.
+         */
+        const std::string& StaticBytes() const
+        {
+            return m_bytes;
+        }
+
+        /**
+         * Return the slots of the template, in the order that they appear in.
+         */
+        const std::vector<TemplateSlot>& Slots() const
+        {
+            return m_slots;
+        }
+
+    private:
+        /**
+         * Every part of the template that is not a slot, rendered ahead of time.
+         */
+        std::string m_bytes;
+
+        /**
+         * The slots of the template, ordered by their position in the static bytes.
+         */
+        std::vector<TemplateSlot> m_slots;
+
+        /**
+         * The options that the template was compiled with, which also apply to the values of the slots.
+         */
+        ToStringOptions m_options;
+    };
+
+    class Node;
+
+    struct PatchOperation;
+
+    /**
+     * An element on the ancestor stack of a selector search, along with its position among its element siblings,
+     * counting from one.
+     */
+    struct SelectorAncestor
+    {
+        const Node* node;
+        size_t      position;
+    };
+
+    /**
+     * A non-owning view over the children of a node, used to walk children without copying them.
+     * 
+     * Children are linked to their siblings, so walking the view is linear, while indexing into it has to walk from
+     * the first child. Removing the child that an iterator is on invalidates that iterator.
+     */
+    template <typename NodeT>
+    class ChildView
+    {
+    public:
+        /**
+         * Forward iterator that follows the sibling links between children.
+         */
+        class iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type        = NodeT;
+            using difference_type   = std::ptrdiff_t;
+            using pointer           = NodeT*;
+            using reference         = NodeT&;
+
+            explicit iterator(NodeT* node=nullptr)
+                : m_node(node) {}
+
+            NodeT& operator*() const
+            {
+                return *m_node;
+            }
+
+            NodeT* operator->() const
+            {
+                return m_node;
+            }
+
+            iterator& operator++()
+            {
+                m_node = m_node->NextSibling();
+
+                return *this;
+            }
+
+            iterator operator++(int)
+            {
+                iterator previous = *this;
+
+                m_node = m_node->NextSibling();
+
+                return previous;
+            }
+
+            bool operator==(const iterator& other) const
+            {
+                return m_node == other.m_node;
+            }
+
+            bool operator!=(const iterator& other) const
+            {
+                return m_node != other.m_node;
+            }
+
+        private:
+            NodeT* m_node;
+        };
+
+        ChildView() = default;
+
+        ChildView(NodeT* first, NodeT* last, size_t size)
+            : m_first(first)
+            , m_last(last)
+            , m_size(size) {}
+
+        iterator begin() const
+        {
+            return iterator(m_first);
+        }
+
+        iterator end() const
+        {
+            return iterator(nullptr);
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        NodeT& operator[](size_t index) const
+        {
+            NodeT* node = m_first;
+
+            while (index-- > 0)
+                node = node->NextSibling();
+
+            return *node;
+        }
+
+        NodeT& front() const
+        {
+            return *m_first;
+        }
+
+        NodeT& back() const
+        {
+            return *m_last;
+        }
+
+    private:
+        NodeT* m_first = nullptr;
+        NodeT* m_last  = nullptr;
+        size_t m_size  = 0;
+    };
+
+    /**
+     * An immutable, pre-rendered copy of a Node and its children.
+     * 
+     * Parts of a page that are identical for every render, such as navigation or footers, can be rendered once into
+     * a fragment and then appended to any number of nodes with AppendChild. When converting to a string, the
+     * fragment bytes are copied to the output as they are, instead of rendering and escaping the tree again.
+     * 
+     * The rendered bytes are held in a reference counted buffer, so copies of a fragment, and every node that it has
+     * been appended to, share a single buffer. Fragments are opaque to selector queries.
+     */
+    class StaticFragment
+    {
+    public:
+        StaticFragment() = default;
+
+        /**
+         * Render the node passed in once with the options supplied and keep the result.
+         */
+        explicit StaticFragment(const Node& node, ToStringOptions options={});
+
+        /**
+         * Create a fragment from bytes that are already rendered and escaped.
+         */
+        explicit StaticFragment(std::string bytes)
+            : m_bytes(std::make_shared<const std::string>(std::move(bytes))) {}
+
+        /**
+         * Return the rendered bytes of this fragment.
+         */
+        std::string const& ToString() const
+        {
+            static const std::string empty;
+
+            return m_bytes ? *m_bytes : empty;
+        }
+
+        /**
+         * Return the shared buffer holding the rendered bytes of this fragment.
+         */
+        std::shared_ptr<const std::string> const& Buffer() const
+        {
+            return m_bytes;
+        }
+
+    private:
+        /**
+         * The rendered bytes for this fragment, shared between every copy.
+         */
+        std::shared_ptr<const std::string> m_bytes;
+    };
+
+    /**
+     * A class that represents any type of HTML node to construct in CTML.
+     * 
+     * For each node, there is at the minimum a type that represents the kind
+     * of node that is being constructed, see the `NodeType` enum for the
+     * different kinds of nodes that are able to be constructed at the moment.
+     * 
+     * Each node also has a vector of children that house other nodes.
+     * 
+     * Once you have constructed a node to your liking, you can get a string
+     * representation of this node through the ToString method.
+     * 
+     * Const methods never change a node or its children, so one tree can be
+     * rendered and searched from any number of threads at once, as long as no
+     * thread calls a non-const method on it at the same time. Non-const
+     * methods, including non-const searches, may copy children that are shared
+     * with copies of the node, and so need the node to only be used by one
+     * thread. Copies made before sharing a tree between threads may still be
+     * changed freely, as shared children are copied before they are changed.
+     */
+    class Node
+    {
+    public:
+        Node() = default;
+
+        /**
+         * Create an empty node of the type specified.
+         * 
+         * Optionally, you can specify a name as well as content
+         * which will be added according to the type.
+         */
+        Node(const NodeType& type,
+            std::string name="",
+            std::string content="")
+            : m_type(type)
+        {
+            // Use the name of the Node for the content as content should be ignored
+            if (type == NodeType::COMMENT)
+                m_content = name;
+            else if (type == NodeType::DOCUMENT_TYPE)
+                m_content = name;
+            else if (type == NodeType::SLOT)
+                m_content = name;
+            else if (type == NodeType::TEXT)
+            {
+                m_content = name;
+
+                this->EscapeContent();
+            }
+            else if (type == NodeType::ELEMENT)
+            {
+                this->SetName(name);
+
+                if (!content.empty())
+                    this->AppendText(content);
+            }
+        }
+
+        /**
+         * Create an element node with the name specified.
+         */
+        Node(std::string name)
+            : m_type(NodeType::ELEMENT)
+        {
+            this->SetName(name);
+        }
+
+        /**
+         * Create an element node with the specified name and containing a text node
+         * with the content specified.
+         */
+        Node(std::string name, std::string content)
+            : m_type(NodeType::ELEMENT)
+        {
+            this->SetName(name);
+            this->AppendText(content);
+        }
+
+        Node(const Node&) = default;
+
+        /**
+         * Move a node, taking its children along without copying them, so pointers to the children stay valid and
+         * now lead to this node.
+         */
+        Node(Node&& other) noexcept
+            : m_links(other.m_links)
+            , m_type(other.m_type)
+            , m_name(std::move(other.m_name))
+            , m_classes(std::move(other.m_classes))
+            , m_classMask(other.m_classMask)
+            , m_id(std::move(other.m_id))
+            , m_content(std::move(other.m_content))
+            , m_escapedContent(std::move(other.m_escapedContent))
+            , m_trusted(other.m_trusted)
+            , m_repeat(other.m_repeat)
+            , m_cacheKey(std::move(other.m_cacheKey))
+            , m_hash(other.m_hash)
+            , m_fragment(std::move(other.m_fragment))
+            , m_closeTag(other.m_closeTag)
+            , m_children(std::move(other.m_children))
+            , m_attributes(std::move(other.m_attributes))
+        {
+            this->AdoptChildren();
+        }
+
+        Node& operator=(const Node&) = default;
+
+        Node& operator=(Node&& other) noexcept
+        {
+            if (this == &other)
+                return *this;
+
+            m_links          = other.m_links;
+            m_type           = other.m_type;
+            m_name           = std::move(other.m_name);
+            m_classes        = std::move(other.m_classes);
+            m_classMask      = other.m_classMask;
+            m_id             = std::move(other.m_id);
+            m_content        = std::move(other.m_content);
+            m_escapedContent = std::move(other.m_escapedContent);
+            m_trusted        = other.m_trusted;
+            m_repeat         = other.m_repeat;
+            m_cacheKey       = std::move(other.m_cacheKey);
+            m_hash           = other.m_hash;
+            m_fragment       = std::move(other.m_fragment);
+            m_closeTag       = other.m_closeTag;
+            m_children       = std::move(other.m_children);
+            m_attributes     = std::move(other.m_attributes);
+
+            this->AdoptChildren();
+
+            return *this;
+        }
+
+        /**
+         * Generate a string for this Node instance.
+         * 
+         * This function is recursive, so ToString is called for every Node that is a
+         * child of this node.
+         *
+         * You may optionally specify a StringFormatting enum for how to format the string
+         * as well as an indent level to append a number of spaces before this string.
+         */
+        std::string ToString(ToStringOptions options={}) const
+        {
+            std::string output;
+
+            this->AppendToString(output, options);
+
+            return output;
+        }
+
+        /**
+         * Append the string for this Node instance to the end of the output passed in.
+         * 
+         * This is used by ToString so that an entire tree is rendered into one buffer, instead of
+         * building and copying a separate string for every child.
+         */
+        void AppendToString(std::string& output, const ToStringOptions& options) const
+        {
+            this->AppendToString(output, options, nullptr);
+        }
+
+        /**
+         * Compile this node and its children into a template, rendered ahead of time with the options passed in.
+         * 
+         * Slots added with AppendSlot and SetAttributeSlot are left to be filled in when the template is rendered.
+         */
+        Template Compile(ToStringOptions options={}) const
+        {
+            std::string bytes;
+            std::vector<TemplateSlot> slots;
+
+            this->AppendToString(bytes, options, &slots);
+
+            return Template(std::move(bytes), std::move(slots), options);
+        }
+
+        /**
+         * Return a 64-bit hash of the content of this node and all of its children, without rendering them.
+         * 
+         * The hash covers the type, name, classes, id, attributes and content of every node, with attributes hashed
+         * in order of their names, so it only changes when the node or one of its children changes and can be used
+         * as an ETag for the rendered node. Each node caches its hash until it or one of its children is changed,
+         * so hashing again after a change only hashes the nodes above the change.
+         */
+        uint64_t Hash() const
+        {
+            uint64_t hash = m_hash.value.load(std::memory_order_acquire);
+
+            if (hash != 0)
+                return hash;
+
+            hash = content_hash_round(2870177450012600261ULL, static_cast<uint64_t>(m_type));
+            hash = content_hash_round(hash, static_cast<uint64_t>(m_closeTag) | (static_cast<uint64_t>(m_trusted) << 1) | (static_cast<uint64_t>(m_repeat) << 2));
+
+            hash = content_hash_bytes(hash, m_name);
+            hash = content_hash_bytes(hash, m_id);
+            hash = content_hash_bytes(hash, m_content);
+
+            hash = content_hash_round(hash, m_classes.size());
+
+            for (const auto& className : m_classes)
+                hash = content_hash_bytes(hash, className);
+
+            std::vector<const Attribute*> attributes;
+
+            for (const auto& attr : m_attributes)
+                attributes.push_back(&attr);
+
+            std::sort(attributes.begin(), attributes.end(), compare_attribute_names);
+
+            hash = content_hash_round(hash, attributes.size());
+
+            for (const Attribute* attr : attributes)
+            {
+                hash = content_hash_bytes(hash, attr->name);
+                hash = content_hash_bytes(hash, attr->value);
+                hash = content_hash_bytes(hash, attr->slot);
+                hash = content_hash_round(hash, static_cast<uint64_t>(attr->context));
+            }
+
+            if (m_fragment)
+                hash = content_hash_bytes(hash, *m_fragment);
+
+            hash = content_hash_round(hash, this->ChildCount());
+
+            for (const Node* child = this->FirstChild(); child != nullptr; child = child->NextSibling())
+                hash = content_hash_round(hash, child->Hash());
+
+            hash = content_hash_finish(hash);
+
+            // zero marks a hash that has not been computed
+            if (hash == 0)
+                hash = 1;
+
+            m_hash.value.store(hash, std::memory_order_release);
+
+            return hash;
+        }
+
+        /**
+         * Set the name of this element.
+         * 
+         * You may also enter a CSS selector-like string for the name to fill
+         * in pieces of this element, such as classes, id, and attributes.
+         * 
+         * Also for this function, the element name should be the first piece
+         * of the selector, and if it is not, the name will not be set correctly.
+         */
+        Node& SetName(const std::string& name)
+        {
+            this->InvalidateHash();
+
+            // most nodes are created with plain tag names such as `td` or `li`, so if a single scan finds none of
+            // the selector characters, skip the tokenizer entirely and assign the name directly
+            if (!name.empty() && name.find_first_of(".#[ >+~*,") == std::string::npos)
+            {
+                this->m_name = name;
+
+                return *this;
+            }
+
+            std::vector<SelectorToken> tokens = parse_selector(name, false);
+
+            return SetName(std::move(tokens));
+        }
+
+        /**
+         * Return the element name for this Node.
+         */
+        std::string const& Name() const
+        {
+            return m_name;
+        }
+
+        /**
+         * Get the value of an attribute associated with this element.
+         * 
+         * Returns blank if there is no attribute of that name.
+         */
+        std::string GetAttribute(const std::string& name) const
+        {
+            if (name == "class")
+            {
+                std::stringstream output;
+
+                for (size_t index = 0; index < m_classes.size(); index++)
+                {
+                    output << m_classes[index];
+
+                    if (index != m_classes.size() - 1)
+                        output << " ";
+                }
+
+                return output.str();
+            }
+
+            if (name == "id")
+                return m_id;
+
+            const std::string* value = m_attributes.Find(name);
+
+            if (value != nullptr)
+                return *value;
+            
+            return "";
+        }
+
+        /**
+         * Get a CSS selector like string for this element.
+         */
+        std::string GetSelector() const
+        {
+            std::stringstream output;
+
+            output << m_name;
+
+            // convert the class array to a string with dots
+            for (auto& element : m_classes)
+                output << "." << element;
+            
+            output << "#" << m_id;
+
+            return output.str();
+        }
+
+        /**
+         * Set a single attribute for a Node to a value.
+         * 
+         * The value is escaped for the context passed in when it is output, such as EscapeContext::URL for `href`
+         * values, so it should not be escaped beforehand. The context is not used for the `id` and `class` attributes.
+         */
+        Node& SetAttribute(const std::string& name, std::string value, EscapeContext context=EscapeContext::HTML)
+        {
+            this->InvalidateHash();
+
+            if (name == "id")
+            {
+                m_id = value;
+                
+                return *this;
+            }
+
+            // if trying to manually set a class attribute, split the value by
+            // spaces and then add the classes to the class list
+            if (name == "class")
+            {
+                m_classes.clear();
+                m_classMask = 0;
+
+                // create a stringstream from the value for use in splitting
+                std::istringstream stream(value);
+
+                std::string temp = "";
+
+                // getline also works with a specific delimeter, allowing us
+                // to split by spaces easily
+                while (std::getline(
+                    stream,
+                    temp,
+                    ' '
+                ))
+                    this->AddClass(std::move(temp));
+
+                return *this;
+            }
+
+            m_attributes.Set(name, std::move(value), context);
+            
+            return *this;
+        }
+
+        /**
+         * Set the key that this node is stored under when it is rendered with a fragment cache in the options.
+         * 
+         * Once the node is stored, it is copied from the cache rather than rendered until the fragment is evicted, so
+         * the key should change whenever the node or its children change. An empty key turns caching off.
+         */
+        Node& SetCacheKey(std::string key)
+        {
+            m_cacheKey = std::move(key);
+
+            return *this;
+        }
+
+        /**
+         * Return the fragment cache key of this node, which is empty if the node is not cached.
+         */
+        const std::string& GetCacheKey() const
+        {
+            return m_cacheKey;
+        }
+
+        /**
+         * Leave the value of a single attribute to the template slot passed in.
+         * 
+         * The attribute is only output with its name until the node is compiled with Compile, where the value of the
+         * slot is escaped for the context passed in when the template is rendered. The `id` and `class` attributes
+         * can not be left to a slot.
+         */
+        Node& SetAttributeSlot(const std::string& name, std::string slot, EscapeContext context=EscapeContext::HTML)
+        {
+            this->InvalidateHash();
+
+            if (name == "id" || name == "class")
+                return *this;
+
+            m_attributes.SetSlot(name, std::move(slot), context);
+
+            return *this;
+        }
+
+        /**
+         * Remove a single attribute from a Node, if it is set.
+         */
+        Node& RemoveAttribute(const std::string& name)
+        {
+            this->InvalidateHash();
+
+            if (name == "id")
+                m_id.clear();
+            else if (name == "class")
+            {
+                m_classes.clear();
+                m_classMask = 0;
+            }
+            else
+                m_attributes.Remove(name);
+
+            return *this;
+        }
+
+        /**
+         * Set the node type for this Node instance.
+         */
+        Node& SetType(NodeType type)
+        {
+            this->InvalidateHash();
+
+            this->m_type = type;
+
+            this->EscapeContent();
+        
+            return *this;
+        }
+
+        /**
+         * Sets the content of a non-element node.
+         */
+        Node& SetContent(const std::string& text)
+        {
+            this->InvalidateHash();
+
+            this->m_content = text;
+
+            this->EscapeContent();
+        
+            return *this;
+        }
+
+        /**
+         * Set the parent instance of this node.
+         */
+        Node& SetParent(Node* parent)
+        {
+            this->m_links.parent = parent;
+
+            return *this;
+        }
+
+        /**
+         * Toggle the state of a class based on its name.
+         */
+        Node& ToggleClass(const std::string& className)
+        {
+            this->InvalidateHash();
+
+            auto find = m_classes.end();
+
+            // the class can only be in the list if its bit is set in the mask
+            if (m_classMask & class_mask_bit(className))
+                find = std::find(m_classes.begin(), m_classes.end(), className);
+            
+            // if the class exists, remove it, otherwise add it
+            if (find != m_classes.end())
+            {
+                m_classes.erase(find);
+
+                // other classes may share the bit of the removed class, so rebuild the mask from what is left
+                m_classMask = 0;
+
+                for (const auto& remaining : m_classes)
+                    m_classMask |= class_mask_bit(remaining);
+            }
+            else
+                this->AddClass(className);
+
+            return *this;
+        }
+        
+        /**
+         * Append a constant child node to this node.
+         * 
+         * This method is used mostly when constructing a node in an append call
+         * after which then the parent node takes ownership of the node.
+         */
+        Node& AppendChild(const Node& child)
+        {
+            this->InvalidateHash();
+
+            LinkChild(this->MutableChildList(), new Node(child), nullptr);
+
+            return *this;
+        }
+
+        /**
+         * Append a temporary child node to this node by moving it into the children.
+         */
+        Node& AppendChild(Node&& child)
+        {
+            this->InvalidateHash();
+
+            LinkChild(this->MutableChildList(), new Node(std::move(child)), nullptr);
+
+            return *this;
+        }
+
+        /**
+         * Append a child node to this node.
+         * 
+         * This method takes a reference to the node to be appended and changes
+         * its parent to this node, unless the node is already a child of another
+         * node, in which case it is copied like any other node.
+         * 
+         * This is for when using the Remove() call on a node outside of the
+         * children vector.
+         */
+        Node& AppendChild(Node& child)
+        {
+            // a node that is already in a tree keeps its parent there, so it is only copied
+            if (child.m_links.list != nullptr)
+                return this->AppendChild(static_cast<const Node&>(child));
+
+            this->InvalidateHash();
+
+            // the child only tracks its latest copy
+            if (child.m_links.appended != nullptr)
+                child.m_links.appended->m_links.handle = nullptr;
+
+            // the child keeps a pointer to its copy, so the list is exposed like any other pointer to a child
+            child.m_links.appended = LinkChild(this->ExposedChildList(), new Node(child), nullptr);
+            child.m_links.appended->m_links.handle = &child;
+
+            child.SetParent(this);
+
+            return *this;
+        }
+
+        /**
+         * Append a static fragment to this node.
+         * 
+         * The fragment buffer is shared rather than copied, so this is cheap regardless of the fragment size.
+         */
+        Node& AppendChild(const StaticFragment& fragment)
+        {
+            Node fragmentNode;
+
+            fragmentNode.m_type     = NodeType::STATIC_FRAGMENT;
+            fragmentNode.m_fragment = fragment.Buffer();
+
+            return this->AppendChild(std::move(fragmentNode));
+        }
+
+        /**
+         * Append a single text node to the element.
+         * 
+         * This is the recommended way to set content now
+         * as opposed to using the SetContent method.
+         */
+        Node& AppendText(std::string text)
+        {
+            this->InvalidateHash();
+
+            Node textNode;
+
+            textNode.SetType(NodeType::TEXT)
+                    .SetContent(text);
+
+            LinkChild(this->MutableChildList(), new Node(std::move(textNode)), nullptr);
+
+            return *this;
+        }
+
+        /**
+         * Append trusted content to the children of this node, which is copied to the output as it is.
+         * 
+         * This is for content that is already escaped, or that is meant to be HTML, such as the output of a
+         * sanitizer, so it is never escaped again, whatever the escapeContent option is set to. Never pass content
+         * from an untrusted source to this method.
+         */
+        Node& AppendRaw(std::string text)
+        {
+            this->InvalidateHash();
+
+            Node textNode;
+
+            textNode.m_trusted = true;
+
+            textNode.SetType(NodeType::TEXT)
+                    .SetContent(text);
+
+            LinkChild(this->MutableChildList(), new Node(std::move(textNode)), nullptr);
+
+            return *this;
+        }
+
+        /**
+         * Append a text slot to the children of this node, which is filled in when the node is compiled with
+         * Compile and rendered.
+         * 
+         * The slot is left out of the output when the node is rendered with ToString.
+         */
+        Node& AppendSlot(const std::string& name)
+        {
+            this->InvalidateHash();
+
+            Node slotNode;
+
+            slotNode.SetType(NodeType::SLOT)
+                    .SetContent(name);
+
+            LinkChild(this->MutableChildList(), new Node(std::move(slotNode)), nullptr);
+
+            return *this;
+        }
+
+        /**
+         * Append a list slot to the children of this node, where the item passed in is rendered once for each item
+         * of the list when the node is compiled with Compile and rendered.
+         * 
+         * The item may have slots of its own, which are filled in separately for each item.
+         */
+        Node& AppendSlot(const std::string& name, const Node& item)
+        {
+            this->InvalidateHash();
+
+            Node slotNode;
+
+            slotNode.SetType(NodeType::SLOT)
+                    .SetContent(name);
+
+            slotNode.m_repeat = true;
+
+            slotNode.AppendChild(item);
+
+            LinkChild(this->MutableChildList(), new Node(std::move(slotNode)), nullptr);
+
+            return *this;
+        }
+
+        /**
+         * Removes this particular node from its parent.
+         * 
+         * The node is unlinked from its siblings in constant time and then destroyed, so any pointer or reference
+         * to it is invalid afterwards. A node that was passed to AppendChild(Node&) is not itself in the tree, so
+         * the child that was copied from it is removed instead, or nothing if that child is already gone.
+         */
+        void Remove()
+        {
+            if (m_links.list == nullptr)
+            {
+                if (m_links.parent == nullptr || m_links.appended == nullptr)
+                    return;
+
+                size_t index = 0;
+
+                for (const Node* child = m_links.parent->FirstChild(); child != nullptr; child = child->NextSibling())
+                {
+                    if (child == m_links.appended)
+                    {
+                        m_links.parent->RemoveChild(index);
+
+                        break;
+                    }
+
+                    index++;
+                }
+
+                return;
+            }
+
+            m_links.parent->InvalidateHash();
+
+            UnlinkChild(*m_links.list, this);
+
+            delete this;
+        }
+
+        /**
+         * Remove a Node from the children by index.
+         * 
+         * The index is zero-based for removal.
+         */
+        Node& RemoveChild(size_t index)
+        {
+            this->InvalidateHash();
+
+            ChildList& children = this->MutableChildList();
+
+            if (index >= children.count)
+                return *this;
+
+            Node* child = children.first;
+
+            while (index-- > 0)
+                child = child->m_links.next;
+
+            UnlinkChild(children, child);
+
+            delete child;
+
+            return *this;
+        }
+
+        /**
+         * Insert a node as the sibling directly before this one, in constant time.
+         * 
+         * Nothing is inserted if this node is not a child of another node.
+         */
+        Node& InsertBefore(const Node& sibling)
+        {
+            return this->InsertBefore(Node(sibling));
+        }
+
+        /**
+         * Insert a temporary node as the sibling directly before this one, in constant time.
+         * 
+         * Nothing is inserted if this node is not a child of another node.
+         */
+        Node& InsertBefore(Node&& sibling)
+        {
+            if (m_links.list != nullptr)
+            {
+                m_links.parent->InvalidateHash();
+
+                LinkChild(*m_links.list, new Node(std::move(sibling)), this);
+            }
+
+            return *this;
+        }
+
+        /**
+         * Insert a node as the sibling directly after this one, in constant time.
+         * 
+         * Nothing is inserted if this node is not a child of another node.
+         */
+        Node& InsertAfter(const Node& sibling)
+        {
+            return this->InsertAfter(Node(sibling));
+        }
+
+        /**
+         * Insert a temporary node as the sibling directly after this one, in constant time.
+         * 
+         * Nothing is inserted if this node is not a child of another node.
+         */
+        Node& InsertAfter(Node&& sibling)
+        {
+            if (m_links.list != nullptr)
+            {
+                m_links.parent->InvalidateHash();
+
+                LinkChild(*m_links.list, new Node(std::move(sibling)), m_links.next);
+            }
+
+            return *this;
+        }
+
+        /**
+         * Get a single child by its element name.
+         * 
+         * Note: This method only will return one child that is referenced by its name. If you need multiple matches
+         * or need more fine-grained search with classes, IDs, or attributes, use the QuerySelector method.
+         */
+        Node& GetChildByName(const std::string& name)
+        {
+            Node* child = this->ExposedChildList().first;
+
+            while (child != nullptr && child->Name() != name)
+                child = child->m_links.next;
+
+            return *child;
+        }
+
+        /**
+         * Get a single child by its element name, without changing this node.
+         * 
+         * Unlike the non-const version, this reads any children shared with copies of this node in place, rather than
+         * copying them first, so it is safe to call from several threads at once.
+         */
+        const Node& GetChildByName(const std::string& name) const
+        {
+            const Node* child = this->FirstChild();
+
+            while (child != nullptr && child->Name() != name)
+                child = child->NextSibling();
+
+            return *child;
+        }
+
+        /**
+         * Searches recursively through the child nodes to find matches to the provided string selector.
+         * 
+         * Keep in mind that this will only search *this* node's *children*, starting with the direct children, and will
+         * not return the current node. Matches are returned in document order. A selector list such as `h1, h2` is
+         * searched in the same traversal, and an element that matches more than one of the selectors is only returned
+         * once.
+         */
+        std::vector<Node*> QuerySelector(const std::string& selector)
+        {
+            std::vector<std::vector<Node*>> matches = this->QuerySelectorAll(std::vector<std::string>{ selector });
+
+            return std::move(matches.front());
+        }
+
+        /**
+         * Searches recursively through the child nodes to find matches to the provided string selector, without
+         * changing this node.
+         * 
+         * The matches are the same as the non-const version, returned as const pointers. As the search only reads the
+         * tree, any number of threads may search the same tree at once, as long as no thread changes it meanwhile.
+         */
+        std::vector<const Node*> QuerySelector(const std::string& selector) const
+        {
+            std::vector<std::vector<const Node*>> matches = this->QuerySelectorAll(std::vector<std::string>{ selector });
+
+            return std::move(matches.front());
+        }
+
+        /**
+         * Searches recursively through the child nodes for matches to every selector passed in, in one traversal.
+         * 
+         * The matches for each selector are returned in the same order as the selectors, and are in document order.
+         * This is much quicker than a QuerySelector call for each selector on large trees, as every node is only
+         * visited once, and is only compared against the selectors that could match it.
+         * 
+         * The tree is searched in place like the const version, and only the children on the way down to each match
+         * that are shared with a copy of this node are copied, so that the pointers returned can be used to change
+         * this node alone. Searching a copy of a large tree for a few nodes only copies the nodes above them.
+         */
+        std::vector<std::vector<Node*>> QuerySelectorAll(const std::vector<std::string>& selectors)
+        {
+            std::unordered_map<const Node*, std::vector<const Node*>> paths;
+
+            std::vector<std::vector<const Node*>> found = SearchSelectors(static_cast<const Node&>(*this), selectors, &paths);
+
+            return this->ExposeMatches(found, paths);
+        }
+
+        /**
+         * Searches recursively through the child nodes for matches to every selector passed in, in one traversal,
+         * without changing this node.
+         */
+        std::vector<std::vector<const Node*>> QuerySelectorAll(const std::vector<std::string>& selectors) const
+        {
+            return SearchSelectors(*this, selectors);
+        }
+
+        /**
+         * Searches the child nodes for matches to the provided string selector, splitting the search across threads.
+         * 
+         * Each element child of this node is searched as its own task, with the tasks shared between the number of
+         * threads passed in, or one per core if zero. As the search does not change the tree, the matches are the
+         * same as QuerySelector, in document order, just returned as const pointers.
+         * 
+         * This is only worth it for very large trees, as every call starts its own threads. The tree must not be
+         * changed by any other thread while the search runs. If a thread can not be started, the threads that did
+         * start share the tasks with the calling thread, which searches alone if none did. An exception thrown while
+         * searching is rethrown once every thread has stopped.
+         */
+        std::vector<const Node*> QuerySelectorParallel(const std::string& selector, unsigned threadCount=0) const
+        {
+            SelectorBatch batch(std::vector<std::string>{ selector });
+
+            std::vector<SelectorAncestor> roots;
+
+            for (const Node* child = this->FirstChild(); child != nullptr; child = child->NextSibling())
+            {
+                if (child->m_type == NodeType::ELEMENT)
+                    roots.push_back({ child, roots.size() + 1 });
+            }
+
+            if (threadCount == 0)
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+            threadCount = static_cast<unsigned>(std::min<size_t>(threadCount, roots.size()));
+
+            std::vector<std::vector<const Node*>> results(roots.size());
+            std::atomic<size_t> next(0);
+
+            std::exception_ptr failure;
+            std::mutex failureMutex;
+
+            // each task only writes to its own result, so the results need no locking, and are merged in order below
+            auto worker = [&]() {
+                try
+                {
+                    std::vector<std::vector<const Node*>> matches(1);
+                    std::vector<SelectorAncestor> ancestors;
+                    std::vector<size_t> candidates;
+
+                    AncestorFilter filter;
+
+                    for (size_t index = next++; index < roots.size(); index = next++)
+                    {
+                        CollectSubtreeMatches(*roots[index].node, roots[index].position, batch, ancestors, filter, candidates, matches, nullptr);
+
+                        results[index].swap(matches.front());
+
+                        matches.front().clear();
+                    }
+                }
+                catch (...)
+                {
+                    // an exception can not leave a thread, so the first one is kept for the calling thread, and the
+                    // tasks that are left are skipped
+                    std::lock_guard<std::mutex> lock(failureMutex);
+
+                    if (!failure)
+                        failure = std::current_exception();
+
+                    next = roots.size();
+                }
+            };
+
+            std::vector<std::thread> threads;
+
+            // reserved up front, so that adding a thread that has started never has to allocate
+            threads.reserve(threadCount);
+
+            try
+            {
+                for (unsigned thread = 1; thread < threadCount; thread++)
+                    threads.emplace_back(worker);
+            }
+            catch (const std::system_error&)
+            {
+                // the threads that did start are enough, as the tasks are taken by whichever thread is free
+            }
+
+            worker();
+
+            for (auto& thread : threads)
+                thread.join();
+
+            if (failure)
+                std::rethrow_exception(failure);
+
+            std::vector<const Node*> merged;
+
+            for (const auto& result : results)
+                merged.insert(merged.end(), result.begin(), result.end());
+
+            return merged;
+        }
+
+        /**
+         * Set whether or not this element should have a closing tag or not.
+         */
+        Node& UseClosingTag(bool close)
+        {
+            this->InvalidateHash();
+
+            this->m_closeTag = close;
+
+            return *this;
+        }
+
+        /**
+         * Get the vector of child nodes from this node instance.
+         * 
+         * This returns a copy of the children, to walk them without copying use Children() instead.
+         */
+        std::vector<Node> GetChildren() const
+        {
+            std::vector<Node> children;
+
+            children.reserve(this->ChildCount());
+
+            for (const Node* child = this->FirstChild(); child != nullptr; child = child->NextSibling())
+                children.push_back(*child);
+
+            return children;
+        }
+
+        /**
+         * Get a read-only view over the child nodes of this node instance without copying them.
+         */
+        ChildView<const Node> Children() const
+        {
+            if (!m_children.list)
+                return ChildView<const Node>();
+
+            return ChildView<const Node>(m_children.list->first, m_children.list->last, m_children.list->count);
+        }
+
+        /**
+         * Get a view over the child nodes of this node instance that allows changing them in place.
+         */
+        ChildView<Node> Children()
+        {
+            ChildList& children = this->ExposedChildList();
+
+            return ChildView<Node>(children.first, children.last, children.count);
+        }
+
+        /**
+         * Get the number of child nodes of this node instance.
+         */
+        size_t ChildCount() const
+        {
+            return m_children.list ? m_children.list->count : 0;
+        }
+
+        /**
+         * Get a single child by its zero-based index.
+         * 
+         * As children are linked to each other, this walks from the first child.
+         */
+        const Node& GetChild(size_t index) const
+        {
+            if (index >= this->ChildCount())
+                throw std::out_of_range("CTML::Node::GetChild index out of range");
+
+            return this->Children()[index];
+        }
+
+        /**
+         * Get a single child by its zero-based index.
+         * 
+         * As children are linked to each other, this walks from the first child.
+         */
+        Node& GetChild(size_t index)
+        {
+            if (index >= this->ChildCount())
+                throw std::out_of_range("CTML::Node::GetChild index out of range");
+
+            return this->Children()[index];
+        }
+
+        /**
+         * Get the first child of this node, or null if there are no children.
+         */
+        const Node* FirstChild() const
+        {
+            return m_children.list ? m_children.list->first : nullptr;
+        }
+
+        /**
+         * Get the first child of this node, or null if there are no children.
+         */
+        Node* FirstChild()
+        {
+            return this->ChildCount() > 0 ? this->ExposedChildList().first : nullptr;
+        }
+
+        /**
+         * Get the last child of this node, or null if there are no children.
+         */
+        const Node* LastChild() const
+        {
+            return m_children.list ? m_children.list->last : nullptr;
+        }
+
+        /**
+         * Get the last child of this node, or null if there are no children.
+         */
+        Node* LastChild()
+        {
+            return this->ChildCount() > 0 ? this->ExposedChildList().last : nullptr;
+        }
+
+        /**
+         * Get the sibling directly before this node, or null if this is the first child or not in a tree.
+         */
+        const Node* PreviousSibling() const
+        {
+            return m_links.previous;
+        }
+
+        /**
+         * Get the sibling directly before this node, or null if this is the first child or not in a tree.
+         */
+        Node* PreviousSibling()
+        {
+            return m_links.previous;
+        }
+
+        /**
+         * Get the sibling directly after this node, or null if this is the last child or not in a tree.
+         */
+        const Node* NextSibling() const
+        {
+            return m_links.next;
+        }
+
+        /**
+         * Get the sibling directly after this node, or null if this is the last child or not in a tree.
+         */
+        Node* NextSibling()
+        {
+            return m_links.next;
+        }
+
+    protected:
+        /**
+         * Append the string for this Node instance to the end of the output passed in, recording the position of
+         * every slot in the output when compiling a template.
+         */
+        void AppendToString(std::string& output, const ToStringOptions& options, std::vector<TemplateSlot>* slots) const
+        {
+            // a node with a cache key is copied from the cache when it was already rendered with the same options,
+            // and is rendered and stored otherwise, while templates are always compiled from the nodes themselves
+            if (options.cache != nullptr && slots == nullptr && !m_cacheKey.empty())
+            {
+                const std::string key = fragment_cache_key(m_cacheKey, options);
+
+                std::shared_ptr<const std::string> cached = options.cache->Get(key);
+
+                if (cached != nullptr)
+                {
+                    output += *cached;
+
+                    return;
+                }
+
+                const size_t start = output.size();
+
+                this->AppendNodeString(output, options, slots);
+
+                options.cache->Put(key, output.substr(start));
+
+                return;
+            }
+
+            this->AppendNodeString(output, options, slots);
+        }
+
+        /**
+         * Append the string for this Node instance itself to the end of the output passed in, without looking it up
+         * in a fragment cache.
+         */
+        void AppendNodeString(std::string& output, const ToStringOptions& options, std::vector<TemplateSlot>* slots) const
+        {
+            size_t indent = 0;
+
+            if (options.indentLevel > 0 && options.formatting != StringFormatting::SINGLE_LINE)
+                indent = options.indentLevel * 4;
+
+            // format a comment node with only the set content
+            if (m_type == NodeType::COMMENT)
+            {
+                output.append(indent, ' ');
+                output += "<!--";
+                output += m_content;
+                output += "-->";
+
+                if (options.formatting == StringFormatting::MULTIPLE_LINES)
+                    output += "\n";
+            }
+            // format a special document type node with the content
+            // as the specified type to use
+            else if (m_type == NodeType::DOCUMENT_TYPE)
+            {
+                output.append(indent, ' ');
+                output += "<!DOCTYPE ";
+                output += m_content;
+                output += ">";
+
+                if (options.formatting == StringFormatting::MULTIPLE_LINES)
+                    output += "\n";
+            }
+            // a slot is only filled in by a template, so it is left out of
+            // the output unless a template is being compiled
+            else if (m_type == NodeType::SLOT)
+            {
+                if (slots == nullptr)
+                    return;
+
+                output.append(indent, ' ');
+
+                TemplateSlot slot;
+
+                slot.name     = m_content;
+                slot.position = output.size();
+
+                if (m_repeat)
+                {
+                    // the item of a list is compiled from the children of the slot as a template of its own
+                    std::string itemBytes;
+                    std::vector<TemplateSlot> itemSlots;
+
+                    for (const Node* child = this->FirstChild(); child != nullptr; child = child->NextSibling())
+                        child->AppendToString(itemBytes, options, &itemSlots);
+
+                    slot.type = TemplateSlotType::LIST;
+                    slot.item = std::make_shared<const Template>(std::move(itemBytes), std::move(itemSlots), options);
+                }
+
+                slots->push_back(std::move(slot));
+            }
+            // a static fragment was rendered when it was created, so the
+            // shared bytes are copied to the output as they are
+            else if (m_type == NodeType::STATIC_FRAGMENT)
+            {
+                output.append(indent, ' ');
+
+                if (m_fragment)
+                    output += *m_fragment;
+
+                if (options.formatting == StringFormatting::MULTIPLE_LINES && options.trailingNewline)
+                    output += "\n";
+            }
+            // format a text node with just the content, this node doesn't
+            // follow StringFormatting as it could potentially alter the
+            // document output
+            else if (m_type == NodeType::TEXT)
+            {
+                output.append(indent, ' ');
+
+                // the escaped content is only kept when escaping changes it, and
+                // never for trusted content, which is copied as it is
+                if (m_trusted)
+                    output += m_content;
+                else if (options.escapeContent && !m_escapedContent.empty())
+                    append_encoded(output, m_escapedContent, options.encoding);
+                else
+                    append_encoded(output, m_content, options.encoding);
+            }
+            else if (m_type == NodeType::ELEMENT)
+            {
+                output.append(indent, ' ');
+                output += "<";
+                output += m_name;
+
+                // output classes if there are any to output
+                if (!m_classes.empty())
+                {
+                    output += " class=\"";
+
+                    for (size_t index = 0; index < m_classes.size(); index++)
+                    {
+                        append_encoded(output, m_classes[index], options.encoding);
+
+                        if (index != m_classes.size() - 1)
+                            output += " ";
+                    }
+
+                    output += "\"";
+                }
+
+                // output the ID of the class if one is specified
+                if (!m_id.empty())
+                {
+                    output += " id=\"";
+                    append_encoded(output, m_id, options.encoding);
+                    output += "\"";
+                }
+
+                for (const auto& attr : m_attributes)
+                {
+                    // the attribute value was escaped of invalid characters when it was set
+                    const std::string& value = attr.Output();
+
+                    output += " ";
+                    output += attr.name;
+
+                    // a slot value is only filled in by a template, so the value is left out unless compiling one
+                    if (!attr.slot.empty())
+                    {
+                        if (slots != nullptr)
+                        {
+                            output += "=\"";
+
+                            TemplateSlot slot;
+
+                            slot.type     = TemplateSlotType::ATTRIBUTE;
+                            slot.name     = attr.slot;
+                            slot.context  = attr.context;
+                            slot.position = output.size();
+
+                            slots->push_back(std::move(slot));
+
+                            output += "\"";
+                        }
+
+                        continue;
+                    }
+
+                    // attributes with just the name are identical to blank valued attributes
+                    // thus, output only the attribute name if a blank value is specified.
+                    if (!value.empty())
+                    {
+                        output += "=\"";
+                        append_encoded(output, value, options.encoding);
+                        output += "\"";
+                    }
+                }
+
+                output += ">";
+
+                if (options.formatting == StringFormatting::MULTIPLE_LINES)
+                    output += "\n";
+
+                // if we have a closing tag, then add children as well
+                // as the closing tag to the output
+                if (m_closeTag)
+                {
+                    ToStringOptions childOptions(
+                        options.formatting,
+                        true,
+                        options.indentLevel + 1,
+                        options.escapeContent,
+                        options.encoding,
+                        options.cache
+                    );
+
+                    for (const Node* child = this->FirstChild(); child != nullptr; child = child->NextSibling())
+                        child->AppendToString(output, childOptions, slots);
+
+                    output.append(indent, ' ');
+                    output += "</";
+                    output += m_name;
+                    output += ">";
+
+                    if (options.formatting == StringFormatting::MULTIPLE_LINES && options.trailingNewline)
+                        output += "\n";
+                }
+            }
+        }
+
+        /**
+         * Search the children of the root passed in for matches to every selector passed in, walking them in place.
+         * 
+         * If a map of paths is passed in, the path from the root down to each match is added to it, starting with
+         * the child of the root and ending with the match itself.
+         */
+        static std::vector<std::vector<const Node*>> SearchSelectors(
+            const Node& root,
+            const std::vector<std::string>& selectors,
+            std::unordered_map<const Node*, std::vector<const Node*>>* paths=nullptr)
+        {
+            SelectorBatch batch(selectors);
+
+            std::vector<std::vector<const Node*>> matches(selectors.size());
+            std::vector<SelectorAncestor> ancestors;
+            std::vector<size_t> candidates;
+
+            AncestorFilter filter;
+
+            CollectSelectorMatches(root, batch, ancestors, filter, candidates, matches, paths);
+
+            return matches;
+        }
+
+        /**
+         * Return the matches of a search of this node as pointers that can be used to change it.
+         * 
+         * The children of each node on the path down to a match are exposed, which copies them first if they are
+         * shared with a copy of this node. The searched children are read before their parent is exposed, and stay
+         * alive with the copies that still share them, so each one can be mapped to the child that took its place.
+         */
+        std::vector<std::vector<Node*>> ExposeMatches(
+            const std::vector<std::vector<const Node*>>& found,
+            const std::unordered_map<const Node*, std::vector<const Node*>>& paths)
+        {
+            // the node that each searched node is now, once the nodes above it have been exposed
+            std::unordered_map<const Node*, Node*> exposed;
+            std::unordered_set<const Node*> expanded;
+
+            exposed[this] = this;
+
+            std::vector<std::vector<Node*>> matches(found.size());
+
+            for (size_t index = 0; index < found.size(); index++)
+            {
+                for (const Node* match : found[index])
+                {
+                    const Node* parent = this;
+
+                    for (const Node* step : paths.at(match))
+                    {
+                        if (expanded.insert(parent).second)
+                        {
+                            const Node* child = parent->FirstChild();
+                            Node* copy = exposed[parent]->ExposedChildList().first;
+
+                            for (; child != nullptr; child = child->NextSibling(), copy = copy->m_links.next)
+                                exposed[child] = copy;
+                        }
+
+                        parent = step;
+                    }
+
+                    matches[index].push_back(exposed[match]);
+                }
+            }
+
+            return matches;
+        }
+
+        /**
+         * Walk the children of the parent passed in, in document order, adding each element to the matches of every
+         * selector in the batch that it matches.
+         * 
+         * The ancestor stack holds the elements between the node the search started at and the parent, which the
+         * compounds to the left of the rightmost one are matched against. The position of each child is counted as
+         * the children are walked, so positional pseudo-classes never have to count siblings themselves.
+         */
+        static void CollectSelectorMatches(
+            const Node& parent,
+            const SelectorBatch& batch,
+            std::vector<SelectorAncestor>& ancestors,
+            AncestorFilter& filter,
+            std::vector<size_t>& candidates,
+            std::vector<std::vector<const Node*>>& matches,
+            std::unordered_map<const Node*, std::vector<const Node*>>* paths)
+        {
+            size_t position = 0;
+
+            for (const Node* child = parent.FirstChild(); child != nullptr; child = child->NextSibling())
+            {
+                if (child->m_type != NodeType::ELEMENT)
+                    continue;
+
+                position++;
+
+                CollectSubtreeMatches(*child, position, batch, ancestors, filter, candidates, matches, paths);
+            }
+        }
+
+        /**
+         * Match a single element against the selectors in the batch, then walk its children in turn.
+         * 
+         * The position is where the element is among its element siblings, counting from one.
+         */
+        static void CollectSubtreeMatches(
+            const Node& element,
+            size_t position,
+            const SelectorBatch& batch,
+            std::vector<SelectorAncestor>& ancestors,
+            AncestorFilter& filter,
+            std::vector<size_t>& candidates,
+            std::vector<std::vector<const Node*>>& matches,
+            std::unordered_map<const Node*, std::vector<const Node*>>* paths)
+        {
+            element.CollectCandidates(batch, candidates);
+
+            for (size_t index : candidates)
+            {
+                const CompiledSelector& selector = batch.selectors[index];
+
+                std::vector<const Node*>& target = matches[batch.targets[index]];
+
+                // an element matching several selectors of the same list is only added once, and as the tree is walked
+                // in document order, it can only be the last match added
+                if (!target.empty() && target.back() == &element)
+                    continue;
+
+                if (batch.filterAncestors && !filter.MayContainAll(selector.ancestorHashes))
+                    continue;
+
+                if (!element.MatchesSelector(selector, selector.compounds.size() - 1, ancestors, ancestors.size(), position))
+                    continue;
+
+                target.push_back(&element);
+
+                if (paths != nullptr && paths->find(&element) == paths->end())
+                {
+                    std::vector<const Node*>& path = (*paths)[&element];
+
+                    for (const auto& ancestor : ancestors)
+                        path.push_back(ancestor.node);
+
+                    path.push_back(&element);
+                }
+            }
+
+            if (element.ChildCount() == 0)
+                return;
+
+            ancestors.push_back({ &element, position });
+
+            if (batch.filterAncestors)
+                element.UpdateAncestorFilter(filter, true);
+
+            CollectSelectorMatches(element, batch, ancestors, filter, candidates, matches, paths);
+
+            if (batch.filterAncestors)
+                element.UpdateAncestorFilter(filter, false);
+
+            ancestors.pop_back();
+        }
+
+        /**
+         * Add the element name, id, and classes of this element to the ancestor filter passed in, or remove them.
+         */
+        void UpdateAncestorFilter(AncestorFilter& filter, bool add) const
+        {
+            std::vector<uint64_t> hashes;
+
+            hashes.push_back(ancestor_filter_hash('<', m_name));
+
+            if (!m_id.empty())
+                hashes.push_back(ancestor_filter_hash('#', m_id));
+
+            for (const auto& className : m_classes)
+                hashes.push_back(ancestor_filter_hash('.', className));
+
+            for (uint64_t hash : hashes)
+            {
+                if (add)
+                    filter.Add(hash);
+                else
+                    filter.Remove(hash);
+            }
+        }
+
+        /**
+         * Fill the candidates with the index of every selector in the batch that this element could match, based on
+         * the buckets for its id, classes, and element name.
+         */
+        void CollectCandidates(const SelectorBatch& batch, std::vector<size_t>& candidates) const
+        {
+            candidates.clear();
+
+            // with one selector, the bucket lookups would cost more than the compound prechecks they save
+            if (batch.selectors.size() == 1)
+            {
+                candidates.push_back(0);
+
+                return;
+            }
+
+            if (!m_id.empty())
+            {
+                auto find = batch.byId.find(m_id);
+
+                if (find != batch.byId.end())
+                    candidates.insert(candidates.end(), find->second.begin(), find->second.end());
+            }
+
+            size_t classCandidates = 0;
+
+            for (const auto& className : m_classes)
+            {
+                auto find = batch.byClass.find(className);
+
+                if (find != batch.byClass.end())
+                {
+                    candidates.insert(candidates.end(), find->second.begin(), find->second.end());
+
+                    classCandidates++;
+                }
+            }
+
+            auto find = batch.byElement.find(m_name);
+
+            if (find != batch.byElement.end())
+                candidates.insert(candidates.end(), find->second.begin(), find->second.end());
+
+            candidates.insert(candidates.end(), batch.universal.begin(), batch.universal.end());
+
+            // each selector is only in one bucket, so duplicates can only come from a class being listed twice
+            if (classCandidates > 1)
+            {
+                std::sort(candidates.begin(), candidates.end());
+
+                candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+            }
+        }
+
+        /**
+         * Check if this element matches the compound at the index passed in, and every compound to the left of it.
+         * 
+         * The ancestors of this element are the first `depth` entries of the ancestor stack, with its parent last, and
+         * the position is where this element is among its element siblings, counting from one.
+         */
+        bool MatchesSelector(
+            const CompiledSelector& selector,
+            size_t index,
+            const std::vector<SelectorAncestor>& ancestors,
+            size_t depth,
+            size_t position) const
+        {
+            const CompoundSelector& compound = selector.compounds[index];
+
+            if (!this->MatchesCompound(compound, ancestors, depth, position))
+                return false;
+
+            if (index == 0)
+                return true;
+
+            switch (compound.combinator)
+            {
+                // a descendant has to have any ancestor that matches the rest of the selector
+                case SelectorTokenType::SELECTOR_SEPARATOR:
+                    for (size_t ancestor = depth; ancestor-- > 0;)
+                    {
+                        const SelectorAncestor& entry = ancestors[ancestor];
+
+                        if (entry.node->MatchesSelector(selector, index - 1, ancestors, ancestor, entry.position))
+                            return true;
+                    }
+
+                    return false;
+                // a child has to have its parent match the rest of the selector
+                case SelectorTokenType::SELECTOR_CHILD:
+                    return depth > 0 && ancestors[depth - 1].node->MatchesSelector(
+                        selector,
+                        index - 1,
+                        ancestors,
+                        depth - 1,
+                        ancestors[depth - 1].position
+                    );
+                // siblings share the same ancestors, so only the sibling and its position change
+                case SelectorTokenType::SELECTOR_SIBLING:
+                case SelectorTokenType::SELECTOR_GENERAL_SIBLING:
+                {
+                    size_t siblingPosition = position;
+
+                    for (const Node* sibling = this->PreviousSibling(); sibling != nullptr; sibling = sibling->PreviousSibling())
+                    {
+                        if (sibling->m_type != NodeType::ELEMENT)
+                            continue;
+
+                        siblingPosition--;
+
+                        if (sibling->MatchesSelector(selector, index - 1, ancestors, depth, siblingPosition))
+                            return true;
+
+                        // an adjacent sibling can only be the element directly before this one
+                        if (compound.combinator == SelectorTokenType::SELECTOR_SIBLING)
+                            return false;
+                    }
+
+                    return false;
+                }
+                default:
+                    return false;
+            }
+        }
+
+        /**
+         * Check if this element passes every test in a single compound selector.
+         */
+        bool MatchesCompound(
+            const CompoundSelector& compound,
+            const std::vector<SelectorAncestor>& ancestors,
+            size_t depth,
+            size_t position) const
+        {
+            if (m_type != NodeType::ELEMENT)
+                return false;
+
+            // reject on the class mask first, as it does not need any string comparisons
+            if ((m_classMask & compound.classMask) != compound.classMask)
+                return false;
+
+            if (!compound.element.empty() && compound.element != "*" && compound.element != m_name)
+                return false;
+
+            if (!compound.id.empty() && compound.id != m_id)
+                return false;
+
+            for (const auto& className : compound.classes)
+            {
+                if (std::find(m_classes.begin(), m_classes.end(), className) == m_classes.end())
+                    return false;
+            }
+
+            for (const auto& attribute : compound.attributes)
+            {
+                const std::string* value = m_attributes.Find(attribute.name);
+
+                std::string special;
+
+                // the id and class attributes are stored on their own, so look them up from there
+                if (attribute.name == "id" && !m_id.empty())
+                    value = &m_id;
+                else if (attribute.name == "class" && !m_classes.empty())
+                    value = &(special = this->GetAttribute("class"));
+
+                if (value == nullptr || !attribute_value_matches(*value, attribute.comparison, attribute.value))
+                    return false;
+            }
+
+            for (const auto& pseudoClass : compound.pseudoClasses)
+            {
+                if (!this->MatchesPseudoClass(pseudoClass, ancestors, depth, position))
+                    return false;
+            }
+
+            return true;
+        }
+
+        /**
+         * Check if this element passes a single pseudo-class test.
+         */
+        bool MatchesPseudoClass(
+            const PseudoClassSelector& pseudoClass,
+            const std::vector<SelectorAncestor>& ancestors,
+            size_t depth,
+            size_t position) const
+        {
+            switch (pseudoClass.type)
+            {
+                case PseudoClassType::FIRST_CHILD:
+                    return position == 1;
+                case PseudoClassType::LAST_CHILD:
+                    for (const Node* sibling = this->NextSibling(); sibling != nullptr; sibling = sibling->NextSibling())
+                    {
+                        if (sibling->m_type == NodeType::ELEMENT)
+                            return false;
+                    }
+
+                    return true;
+                case PseudoClassType::NTH_CHILD:
+                    return nth_position_matches(pseudoClass.a, pseudoClass.b, position);
+                case PseudoClassType::NTH_OF_TYPE:
+                {
+                    size_t typePosition = 1;
+
+                    for (const Node* sibling = this->PreviousSibling(); sibling != nullptr; sibling = sibling->PreviousSibling())
+                    {
+                        if (sibling->m_type == NodeType::ELEMENT && sibling->m_name == m_name)
+                            typePosition++;
+                    }
+
+                    return nth_position_matches(pseudoClass.a, pseudoClass.b, typePosition);
+                }
+                // comments do not count as content, while any text does
+                case PseudoClassType::EMPTY:
+                    for (const Node* child = this->FirstChild(); child != nullptr; child = child->NextSibling())
+                    {
+                        if (child->m_type != NodeType::COMMENT && !(child->m_type == NodeType::TEXT && child->m_content.empty()))
+                            return false;
+                    }
+
+                    return true;
+                case PseudoClassType::NOT:
+                    for (const auto& selector : pseudoClass.selectors)
+                    {
+                        if (this->MatchesSelector(selector, selector.compounds.size() - 1, ancestors, depth, position))
+                            return false;
+                    }
+
+                    return true;
+                case PseudoClassType::UNKNOWN:
+                default:
+                    return false;
+            }
+        }
+
+        /**
+         * Set the name of this element from a vector of selector tokens.
+         * 
+         * Used internally by SetName(const std::string&) for nested node creation with selectors. The first element
+         * in the abbreviation is this node, and every following element is expanded into its children using the
+         * descendant or `>` combinators, the `+` sibling combinator, `*N` multiplication, and `$` numbering.
+         * 
+         * As a node is always a single element, a multiplier or sibling on the first element is ignored. Multipliers
+         * larger than AbbreviationSegment::MAX_MULTIPLIER are clamped to it, and the expansion stops once it has built
+         * AbbreviationSegment::MAX_NODES nodes, which are the first ones in document order.
+         */
+        Node& SetName(std::vector<SelectorToken>&& tokens)
+        {
+            // a selector list has no meaning for construction, so only the first selector is used
+            for (auto itr = tokens.begin(); itr != tokens.end(); ++itr)
+            {
+                if (itr->type == SelectorTokenType::SELECTOR_LIST)
+                {
+                    tokens.erase(itr, tokens.end());
+
+                    break;
+                }
+            }
+
+            std::vector<AbbreviationSegment> segments;
+
+            segments.push_back(AbbreviationSegment(tokens.begin(), tokens.end()));
+
+            for (auto itr = tokens.begin(); itr != tokens.end(); ++itr)
+            {
+                if (itr->type == SelectorTokenType::MULTIPLIER)
+                {
+                    segments.back().multiplier = parse_abbreviation_multiplier(itr->value);
+
+                    continue;
+                }
+
+                // a general sibling is just the next sibling when constructing
+                if (itr->type == SelectorTokenType::SELECTOR_GENERAL_SIBLING)
+                    itr->type = SelectorTokenType::SELECTOR_SIBLING;
+
+                if (itr->type != SelectorTokenType::SELECTOR_SEPARATOR &&
+                    itr->type != SelectorTokenType::SELECTOR_CHILD &&
+                    itr->type != SelectorTokenType::SELECTOR_SIBLING)
+                {
+                    continue;
+                }
+
+                segments.back().end        = itr;
+                segments.back().combinator = itr->type;
+
+                // a trailing combinator has nothing to combine with, so there is no following segment
+                if (itr + 1 != tokens.end())
+                    segments.push_back(AbbreviationSegment(itr + 1, tokens.end()));
+            }
+
+            this->ApplySelectorTokens(segments.front().begin, segments.front().end, 0);
+
+            if (segments.size() > 1 && segments.front().combinator != SelectorTokenType::SELECTOR_SIBLING)
+            {
+                size_t remaining = AbbreviationSegment::MAX_NODES;
+
+                this->ExpandAbbreviation(segments, 1, 0, remaining);
+            }
+
+            return *this;
+        }
+
+        /**
+         * Fill in the name, classes, id, and attributes of this element from a range of selector tokens.
+         * 
+         * When the number is above zero, any `$` in the values is replaced with that number.
+         */
+        void ApplySelectorTokens(SelectorTokenItr begin, SelectorTokenItr end, size_t number)
+        {
+            bool firstToken = true;
+
+            for (auto itr = begin; itr != end; ++itr)
+            {
+                // Cannot continue with selector if the first element is not
+                // an actual element name token
+                if (firstToken && itr->type != SelectorTokenType::ELEMENT)
+                    break;
+
+                firstToken = false;
+
+                std::string value = (number > 0) ? number_abbreviation_value(itr->value, number) : itr->value;
+
+                // For this method, only allow one name to be used at a time
+                // thus any other name token will overwrite the name used.
+                if (itr->type == SelectorTokenType::ELEMENT)
+                    this->m_name = std::move(value);
+
+                // Add to the class list when a class token is hit
+                else if (itr->type == SelectorTokenType::CLASS)
+                    this->AddClass(std::move(value));
+
+                // Overwrite the current ID if that token is hit
+                else if (itr->type == SelectorTokenType::ID)
+                    this->m_id = std::move(value);
+
+                // Attributes are special in that the value can be ommitted for
+                // a blank attribute, since that is still valid, a lookahead is
+                // performed and if the value is found as the next token, it is
+                // added to the attribute map and the next token is skipped.
+                //
+                // otherwise, the blank token is added
+                else if (itr->type == SelectorTokenType::ATTRIBUTE_NAME)
+                {
+                    std::string attrValue = "";
+
+                    // try and get the token after the ATTRIBUTE_COMPARE token as a lookahead
+                    // for construction, the compare token is ignored to just set the token value
+                    if (std::distance(itr, end) > 2 && (itr + 2)->type == SelectorTokenType::ATTRIBUTE_VALUE)
+                    {
+                        attrValue = (number > 0) ? number_abbreviation_value((itr + 2)->value, number) : (itr + 2)->value;
+
+                        itr += 2;
+                    }
+
+                    m_attributes.Set(value, std::move(attrValue));
+                }
+            }
+        }
+
+        /**
+         * Expand the abbreviation segments starting at the index passed in as children of this node.
+         * 
+         * Siblings joined with `+` are appended alongside each other, while a `>` or descendant combinator moves the
+         * remaining segments into each copy of the element before it. Nodes are moved into place rather than copied.
+         * 
+         * The remaining count is the number of nodes that can still be built, and nothing more is appended once it
+         * reaches zero.
+         */
+        void ExpandAbbreviation(std::vector<AbbreviationSegment>& segments, size_t index, size_t number, size_t& remaining)
+        {
+            size_t last = index;
+
+            while (segments.at(last).combinator == SelectorTokenType::SELECTOR_SIBLING && last + 1 < segments.size())
+                last++;
 
-                state = SelectorParserState::NONE;
+            for (size_t current = index; current <= last; current++)
+            {
+                AbbreviationSegment& segment = segments.at(current);
 
-                continue;
-            }
+                bool hasChildren = (segment.combinator != SelectorTokenType::SELECTOR_SIBLING &&
+                                    current + 1 < segments.size());
 
-            temp += current;
-        }
+                for (size_t repeat = 1; repeat <= segment.multiplier; repeat++)
+                {
+                    if (remaining == 0)
+                        return;
 
-        // if we still have a temporary value parsed, just add it to the tokens
-        if (!temp.empty())
-            add_selector_token(tokens, state, temp);
+                    remaining--;
 
-        return tokens;
-    }
+                    // only number elements within a repetition, so a literal `$` elsewhere is left alone
+                    size_t childNumber = (segment.multiplier > 1) ? repeat : number;
 
-    using SelectorTokenItr = std::vector<SelectorToken>::iterator;
+                    Node child;
 
-    /**
-     * Structure used in selector-based search to reference groups of selectors for querying individual node matches.
-     * 
-     * Only stores begin and end iterators to cut down on copying/memory usage.
-     */
-    struct SelectorGroup
-    {
-        SelectorTokenItr begin;
-        SelectorTokenItr end;
+                    child.ApplySelectorTokens(segment.begin, segment.end, childNumber);
 
-        SelectorGroup() = default;
+                    if (hasChildren)
+                        child.ExpandAbbreviation(segments, current + 1, childNumber, remaining);
 
-        SelectorGroup(SelectorTokenItr begin, SelectorTokenItr end)
-            : begin(begin)
-            , end(end) {}
-    };
+                    this->AppendChild(std::move(child));
+                }
+            }
+        }
 
-    /**
-     * A class that represents any type of HTML node to construct in CTML.
-     * 
-     * For each node, there is at the minimum a type that represents the kind
-     * of node that is being constructed, see the `NodeType` enum for the
-     * different kinds of nodes that are able to be constructed at the moment.
-     * 
-     * Each node also has a vector of children that house other nodes.
-     * 
-     * Once you have constructed a node to your liking, you can get a string
-     * representation of this node through the ToString method.
-     */
-    class Node
-    {
-    public:
-        Node() = default;
+    private:
+        friend std::vector<PatchOperation> Diff(const Node& before, const Node& after);
 
         /**
-         * Create an empty node of the type specified.
-         * 
-         * Optionally, you can specify a name as well as content
-         * which will be added according to the type.
+         * Add the operations that change the node before into the node after to the operations passed in, where the
+         * path is the path of both nodes from the root of the diff.
          */
-        Node(const NodeType& type,
-            std::string name="",
-            std::string content="")
-            : m_type(type)
-        {
-            // Use the name of the Node for the content as content should be ignored
-            if (type == NodeType::COMMENT)
-                m_content = name;
-            else if (type == NodeType::DOCUMENT_TYPE)
-                m_content = name;
-            else if (type == NodeType::TEXT)
-                m_content = name;
-            else if (type == NodeType::ELEMENT)
-            {
-                this->SetName(name);
-
-                if (!content.empty())
-                    this->AppendText(content);
-            }
-        }
+        static void DiffNode(const Node& before, const Node& after, std::vector<size_t>& path, std::vector<PatchOperation>& operations);
 
         /**
-         * Create an element node with the name specified.
+         * Add the operations that change the id, classes and attributes of the element before into those of the
+         * element after to the operations passed in.
          */
-        Node(std::string name)
-            : m_type(NodeType::ELEMENT)
-        {
-            this->SetName(name);
-        }
+        static void DiffAttributes(const Node& before, const Node& after, std::vector<size_t>& path, std::vector<PatchOperation>& operations);
 
         /**
-         * Create an element node with the specified name and containing a text node
-         * with the content specified.
+         * Add the operations that change the children of the node before into those of the node after to the
+         * operations passed in.
          */
-        Node(std::string name, std::string content)
-            : m_type(NodeType::ELEMENT)
-        {
-            this->SetName(name);
-            this->AppendText(content);
-        }
+        static void DiffChildren(const Node& before, const Node& after, std::vector<size_t>& path, std::vector<PatchOperation>& operations);
 
         /**
-         * Generate a string for this Node instance.
+         * The children of a node, linked to each other in order, along with the node that they were last
+         * parented to.
          * 
-         * This function is recursive, so ToString is called for every Node that is a
-         * child of this node.
-         *
-         * You may optionally specify a StringFormatting enum for how to format the string
-         * as well as an indent level to append a number of spaces before this string.
+         * Every child is allocated on its own, so it keeps the same address for as long as it is in the list.
          */
-        std::string ToString(ToStringOptions options={}) const
+        struct ChildList
         {
-            std::stringstream output;
+            Node*  first = nullptr;
+            Node*  last  = nullptr;
+            size_t count = 0;
+            Node*  owner = nullptr;
 
-            std::string indent = "";
+            // whether pointers to the children may have been handed out, after which the list is never shared
+            bool exposed = false;
 
-            if (options.indentLevel > 0 && options.formatting != StringFormatting::SINGLE_LINE)
-                indent = std::string(options.indentLevel * 4, ' ');
+            ChildList() = default;
 
-            // format a comment node with only the set content
-            if (m_type == NodeType::COMMENT)
+            ChildList(const ChildList&) = delete;
+            ChildList& operator=(const ChildList&) = delete;
+
+            ~ChildList()
             {
-                output << indent << "<!--" << m_content << "-->";
+                // free the children iteratively, so a long list of siblings does not recurse
+                Node* child = first;
 
-                if (options.formatting == StringFormatting::MULTIPLE_LINES)
-                    output << "\n";
+                while (child != nullptr)
+                {
+                    Node* next = child->m_links.next;
+
+                    delete child;
+
+                    child = next;
+                }
             }
-            // format a special document type node with the content
-            // as the specified type to use
-            else if (m_type == NodeType::DOCUMENT_TYPE)
+        };
+
+        /**
+         * The handle that a node holds its children through.
+         * 
+         * Copies of a node share the same list of children, which is only cloned once one of those copies is
+         * changed. Once pointers to the children have been handed out, such as by a search or by FirstChild, a
+         * change through one of those pointers must not show up in a copy, so an exposed list is cloned when it is
+         * copied instead. A move takes the list itself, exposed or not, so the pointers go along with it.
+         */
+        struct ChildListHandle
+        {
+            std::shared_ptr<ChildList> list;
+
+            ChildListHandle() = default;
+
+            ChildListHandle(const ChildListHandle& other)
+                : list(Share(other.list)) {}
+
+            ChildListHandle(ChildListHandle&& other) noexcept
+                : list(std::move(other.list)) {}
+
+            ChildListHandle& operator=(const ChildListHandle& other)
             {
-                output << indent << "<!DOCTYPE " << m_content << ">";
+                if (this != &other)
+                    list = Share(other.list);
 
-                if (options.formatting == StringFormatting::MULTIPLE_LINES)
-                    output << "\n";
+                return *this;
             }
-            // format a text node with just the content, this node doesn't
-            // follow StringFormatting as it could potentially alter the
-            // document output
-            else if (m_type == NodeType::TEXT)
+
+            ChildListHandle& operator=(ChildListHandle&& other) noexcept
             {
-                output << indent;
+                if (this != &other)
+                    list = std::move(other.list);
 
-                if (options.escapeContent)
-                    output << html_escape(m_content, false);
-                else
-                    output << m_content;
+                return *this;
             }
-            else if (m_type == NodeType::ELEMENT)
-            {
-                output << indent << "<" << m_name << "";
 
-                // output classes if there are any to output
-                if (!m_classes.empty())
-                {
-                    output << " class=\"";
+            /**
+             * Return the list to hold in a copy of the list passed in, which is the same list unless it is exposed.
+             * 
+             * The clone is not owned by any node yet, so its children are pointed at their parent once it is
+             * changed, like any other list taken from another node.
+             */
+            static std::shared_ptr<ChildList> Share(const std::shared_ptr<ChildList>& source)
+            {
+                if (!source || !source->exposed)
+                    return source;
 
-                    for (size_t index = 0; index < m_classes.size(); index++)
-                    {
-                        output << m_classes.at(index);
+                std::shared_ptr<ChildList> clone = std::make_shared<ChildList>();
 
-                        if (index != m_classes.size() - 1)
-                            output << " ";
-                    }
+                for (const Node* child = source->first; child != nullptr; child = child->m_links.next)
+                    LinkChild(*clone, new Node(*child), nullptr);
 
-                    output << "\"";
-                }
+                return clone;
+            }
+        };
 
-                // output the ID of the class if one is specified
-                if (!m_id.empty())
-                    output << " id=\"" << m_id << "\"";
+        /**
+         * The links from a node to its parent and siblings.
+         * 
+         * These describe where a node is in a tree rather than what it is, so a copy of a node starts out with
+         * no links, and assigning to a node that is in a tree leaves it where it is.
+         */
+        struct TreeLinks
+        {
+            Node*      parent   = nullptr;
+            ChildList* list     = nullptr;
+            Node*      previous = nullptr;
+            Node*      next     = nullptr;
 
-                for (const auto& attr : m_attributes)
-                {
-                    // escape the attribute value of invalid characters
-                    std::string value = html_escape(attr.second);
+            // the child that was last copied from this node by AppendChild(Node&), and the node it was copied from,
+            // which point at each other until either of them is destroyed
+            Node*      appended = nullptr;
+            Node*      handle   = nullptr;
 
-                    // attributes with just the name are identical to blank valued attributes
-                    // thus, output only the attribute name if a blank value is specified.
-                    if (value.empty())
-                        output << " " << attr.first;
-                    else
-                        output << " " << attr.first << "=\"" << value + "\"";
-                }
+            TreeLinks() = default;
 
-                output << ">";
+            TreeLinks(const TreeLinks&) {}
 
-                if (options.formatting == StringFormatting::MULTIPLE_LINES)
-                    output << "\n";
+            ~TreeLinks()
+            {
+                if (appended != nullptr)
+                    appended->m_links.handle = nullptr;
 
-                // if we have a closing tag, then add children as well
-                // as the closing tag to the output
-                if (m_closeTag)
-                {
-                    for (const auto& child : m_children)
-                        output << child.ToString(ToStringOptions(
-                            options.formatting,
-                            true,
-                            options.indentLevel + 1,
-                            true
-                        ));
+                if (handle != nullptr)
+                    handle->m_links.appended = nullptr;
+            }
 
-                    output << indent << "</" << m_name << ">";
+            // the node is given new content, so the hash of its parent is no longer valid
+            TreeLinks& operator=(const TreeLinks&)
+            {
+                if (list != nullptr)
+                    parent->InvalidateHash();
 
-                    if (options.formatting == StringFormatting::MULTIPLE_LINES && options.trailingNewline)
-                        output << "\n";
-                }
+                return *this;
             }
-
-            return output.str();
-        }
+        };
 
         /**
-         * Set the name of this element.
-         * 
-         * You may also enter a CSS selector-like string for the name to fill
-         * in pieces of this element, such as classes, id, and attributes.
+         * The cached content hash of a node, which is zero until it is computed.
          * 
-         * Also for this function, the element name should be the first piece
-         * of the selector, and if it is not, the name will not be set correctly.
+         * The hash is atomic so that const nodes can compute and cache it from many threads at once, and a copy of
+         * a node has the same content, so it keeps the same hash.
          */
-        Node& SetName(const std::string& name)
+        struct CachedHash
         {
-            std::vector<SelectorToken> tokens = parse_selector(name);
+            mutable std::atomic<uint64_t> value;
 
-            return SetName(std::move(tokens));
-        }
+            CachedHash()
+                : value(0) {}
 
-        /**
-         * Return the element name for this Node.
-         */
-        std::string const& Name() const
-        {
-            return m_name;
-        }
+            CachedHash(const CachedHash& other)
+                : value(other.value.load(std::memory_order_relaxed)) {}
+
+            CachedHash& operator=(const CachedHash& other)
+            {
+                value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+                return *this;
+            }
+        };
 
         /**
-         * Get the value of an attribute associated with this element.
+         * Clear the cached hash of this node and of every node above it, called whenever the content is changed.
          * 
-         * Returns blank if there is no attribute of that name.
+         * A node can only have a hash when all of its children have one, so once a node without a hash is reached
+         * the nodes above it have none either.
          */
-        std::string GetAttribute(const std::string& name) const
+        void InvalidateHash()
         {
-            if (name == "class")
-            {
-                std::stringstream output;
+            Node* node = this;
 
-                for (size_t index = 0; index < m_classes.size(); index++)
-                {
-                    output << m_classes.at(index);
+            while (node->m_hash.value.load(std::memory_order_relaxed) != 0)
+            {
+                node->m_hash.value.store(0, std::memory_order_relaxed);
 
-                    if (index != m_classes.size() - 1)
-                        output << " ";
-                }
+                // a node that is not in a list is not part of the tree of its parent
+                if (node->m_links.list == nullptr)
+                    break;
 
-                return output.str();
+                node = node->m_links.parent;
             }
-
-            if (name == "id")
-                return m_id;
-
-            auto find = m_attributes.find(name);
-
-            if (find != m_attributes.end())
-                return find->second;
-            
-            return "";
         }
 
         /**
-         * Get a CSS selector like string for this element.
+         * Escape the content of a text node for output, called whenever the content or type is changed.
          */
-        std::string GetSelector() const
+        void EscapeContent()
         {
-            std::stringstream output;
+            m_escapedContent.clear();
 
-            output << m_name;
+            if (m_type == NodeType::TEXT && !m_trusted && m_content.find_first_of("&<>") != std::string::npos)
+                m_escapedContent = html_escape(m_content, false);
+        }
 
-            // convert the class array to a string with dots
-            for (auto& element : m_classes)
-                output << "." << element;
-            
-            output << "#" << m_id;
+        /**
+         * Add a class to the class list, along with its bit in the class mask.
+         */
+        void AddClass(std::string className)
+        {
+            m_classMask |= class_mask_bit(className);
 
-            return output.str();
+            m_classes.push_back(std::move(className));
         }
 
         /**
-         * Set a single attribute for a Node to a value.
+         * Return the children of this node for writing, creating the list if there is none yet.
+         * 
+         * If the children are shared with a copy of this node, they are cloned first. Only the direct children
+         * are cloned, as their own children stay shared until they are written to in turn.
          */
-        Node& SetAttribute(const std::string& name, std::string value)
+        ChildList& MutableChildList()
         {
-            if (name == "id")
-            {
-                m_id = value;
-                
-                return *this;
-            }
+            std::shared_ptr<ChildList>& children = m_children.list;
 
-            // if trying to manually set a class attribute, split the value by
-            // spaces and then add the classes to the class list
-            if (name == "class")
+            if (!children)
             {
-                m_classes.clear();
+                children = std::make_shared<ChildList>();
 
-                // create a stringstream from the value for use in splitting
-                std::istringstream stream(value);
+                children->owner = this;
+            }
+            else if (children.use_count() > 1)
+            {
+                std::shared_ptr<ChildList> clone = std::make_shared<ChildList>();
 
-                std::string temp = "";
+                clone->owner = this;
 
-                // getline also works with a specific delimeter, allowing us
-                // to split by spaces easily
-                while (std::getline(
-                    stream,
-                    temp,
-                    ' '
-                ))
-                    m_classes.push_back(temp);
+                for (const Node* child = children->first; child != nullptr; child = child->m_links.next)
+                    LinkChild(*clone, new Node(*child), nullptr);
 
-                return *this;
+                children = std::move(clone);
             }
 
-            m_attributes[name] = value;
-            
-            return *this;
-        }
+            // the children still point to the node they were created under, which is another copy or where this node
+            // was before being moved, so point them at this node now that it owns them
+            if (children->owner != this)
+            {
+                for (Node* child = children->first; child != nullptr; child = child->m_links.next)
+                    child->m_links.parent = this;
 
-        /**
-         * Set the node type for this Node instance.
-         */
-        Node& SetType(NodeType type)
-        {
-            this->m_type = type;
-        
-            return *this;
+                children->owner = this;
+            }
+
+            return *children;
         }
 
         /**
-         * Sets the content of a non-element node.
+         * Return the children of this node for handing out pointers to them, creating the list if there is none yet.
+         * 
+         * The list is marked as exposed, so that copies of this node clone it rather than share it, as a change
+         * through one of the pointers would otherwise change every copy.
          */
-        Node& SetContent(const std::string& text)
-        {
-            this->m_content = text;
-        
-            return *this;
+        ChildList& ExposedChildList()
+        {
+            ChildList& children = this->MutableChildList();
+
+            children.exposed = true;
+
+            return children;
         }
 
         /**
-         * Set the parent instance of this node.
+         * Point the children of this node at it as their parent, once they have been moved here from another node.
+         * 
+         * Only an exposed list is changed right away, as pointers to its children may have been handed out, while
+         * any other list is changed once this node changes it.
          */
-        Node& SetParent(Node* parent)
+        void AdoptChildren()
         {
-            this->m_parent = parent;
+            ChildList* children = m_children.list.get();
 
-            return *this;
+            if (children == nullptr || !children->exposed)
+                return;
+
+            for (Node* child = children->first; child != nullptr; child = child->m_links.next)
+                child->m_links.parent = this;
+
+            children->owner = this;
         }
 
         /**
-         * Toggle the state of a class based on its name.
+         * Link a newly allocated child into the list before the node passed in, or at the end if that is null.
+         * 
+         * The list takes ownership of the child, which is returned.
          */
-        Node& ToggleClass(const std::string& className)
+        static Node* LinkChild(ChildList& list, Node* child, Node* before)
         {
-            std::vector<std::string>::iterator find = std::find(
-                m_classes.begin(),
-                m_classes.end(),
-                className
-            );
-            
-            // if the class exists, remove it, otherwise add it
-            if (find != m_classes.end())
-                m_classes.erase(find);
+            child->m_links.parent   = list.owner;
+            child->m_links.list     = &list;
+            child->m_links.next     = before;
+            child->m_links.previous = (before != nullptr) ? before->m_links.previous : list.last;
+
+            if (child->m_links.previous != nullptr)
+                child->m_links.previous->m_links.next = child;
             else
-                m_classes.push_back(className);
+                list.first = child;
 
-            return *this;
+            if (before != nullptr)
+                before->m_links.previous = child;
+            else
+                list.last = child;
+
+            list.count++;
+
+            return child;
         }
-        
+
         /**
-         * Append a constant child node to this node.
-         * 
-         * This method is used mostly when constructing a node in an append call
-         * after which then the parent node takes ownership of the node.
+         * Unlink a child from the list, after which the caller owns the child.
          */
-        Node& AppendChild(const Node& child)
+        static void UnlinkChild(ChildList& list, Node* child)
         {
-            m_children.push_back(child);
+            if (child->m_links.previous != nullptr)
+                child->m_links.previous->m_links.next = child->m_links.next;
+            else
+                list.first = child->m_links.next;
+
+            if (child->m_links.next != nullptr)
+                child->m_links.next->m_links.previous = child->m_links.previous;
+            else
+                list.last = child->m_links.previous;
 
-            // once we push back, set the parent in vector so it is not lost
-            m_children.back().SetParent(this);
+            list.count--;
 
-            return *this;
+            child->m_links.parent   = nullptr;
+            child->m_links.list     = nullptr;
+            child->m_links.previous = nullptr;
+            child->m_links.next     = nullptr;
         }
 
         /**
-         * Append a child node to this node.
-         * 
-         * This method takes a reference to the node to be appended and changes
-         * its parent to this node.
+         * The parent and siblings of this Node instance.
          * 
-         * This is for when using the Remove() call on a node outside of the
-         * children vector.
+         * The parent is stored for purposes of removing the node and is set
+         * on an AppendChild call.
          */
-        Node& AppendChild(Node& child)
-        {
-            m_children.push_back(child);
+        TreeLinks m_links;
 
-            child.SetParent(this);
+        /**
+         * The type of Node for this instance.
+         * 
+         * Defaults to an ELEMENT.
+         */
+        NodeType m_type = NodeType::ELEMENT;
 
-            return *this;
-        }
+        /**
+         * The name of the current node.
+         * 
+         * Only used in elements, and represents a tag name such as `div`.
+         */
+        std::string m_name = "";
 
         /**
-         * Append a single text node to the element.
+         * A list of classes for the current Node.
          * 
-         * This is the recommended way to set content now
-         * as opposed to using the SetContent method.
+         * Only used with an element type node. Most elements have one or two
+         * classes, so those are stored inline.
          */
-        Node& AppendText(std::string text)
-        {
-            Node textNode;
+        SmallVector<std::string, 2> m_classes;
 
-            textNode.SetType(NodeType::TEXT)
-                    .SetContent(text)
-                    .SetParent(this);
+        /**
+         * The class mask bits of every class in the class list.
+         */
+        uint64_t m_classMask = 0;
 
-            m_children.push_back(textNode);
+        /**
+         * A singular ID for this element.
+         */
+        std::string m_id = "";
 
-            return *this;
-        }
+        /**
+         * The content for this Node instance.
+         * 
+         * Only used for text and document type nodes. For text it is the actual
+         * content that is sent when converting to a string. For a document type
+         * it is the actual type to set, such as `html`.
+         */
+        std::string m_content = "";
 
         /**
-         * Removes this particular node from its parent.
+         * The content of a text node escaped for output, so that it is only escaped when it is changed rather than
+         * every time the node is rendered.
+         * 
+         * This is left empty when escaping would not change the content.
          */
-        void Remove()
-        {
-            std::vector<Node> parentChildren = m_parent->GetChildren();
+        std::string m_escapedContent = "";
 
-            auto it = std::find_if(
-                parentChildren.begin(),
-                parentChildren.end(),
-                [&](Node const& child) { return child.GetSelector() == this->GetSelector(); }
-            );
+        /**
+         * Whether the content of a text node is trusted, and so is never escaped.
+         */
+        bool m_trusted = false;
 
-            if (it != parentChildren.end())
-                m_parent->RemoveChild(std::distance(parentChildren.begin(), it));
-        }
+        /**
+         * Whether a slot node is a list, with its children as the template for each item.
+         */
+        bool m_repeat = false;
 
         /**
-         * Remove a Node from the children by index.
-         * 
-         * The index is zero-based for removal.
+         * The key that this node is stored under in a fragment cache, if it is cached.
          */
-        Node& RemoveChild(size_t index)
-        {
-            m_children.erase(m_children.begin() + index);
+        std::string m_cacheKey;
 
-            return *this;
-        }
+        /**
+         * The content hash of this node and its children, cached until either is changed.
+         */
+        CachedHash m_hash;
 
         /**
-         * Get a single child by its element name.
+         * The shared rendered bytes for this Node instance.
          * 
-         * Note: This method only will return one child that is referenced by its name. If you need multiple matches
-         * or need more fine-grained search with classes, IDs, or attributes, use the QuerySelector method.
+         * Only used for static fragment nodes.
          */
-        Node& GetChildByName(const std::string& name)
-        {
-            auto it = std::find_if(
-                m_children.begin(),
-                m_children.end(),
-                [&name](Node const& child) { return child.Name() == name; }
-            );
+        std::shared_ptr<const std::string> m_fragment;
 
-            return *it;
-        }
+        /**
+         * Whether or not to close this current Node if it is an element.
+         * 
+         * If this is false, no children are to be printed after the node
+         * as there would be nowhere to place them.
+         * 
+         * Defaults to true.
+         */
+        bool m_closeTag = true;
 
         /**
-         * Searches recursively through the child nodes to find matches to the provided string selector.
+         * The child nodes of this Node instance.
+         * 
+         * Copies of a node share the same list of children, which is only cloned once one of those copies
+         * is changed, so copying a node, or appending a copy of one, does not copy the whole subtree. Until a
+         * node is changed through its parent, its children may still refer to another copy as their parent.
+         * 
+         * Children that pointers were handed out to are never shared, so a change through such a pointer only
+         * changes the tree it was taken from, never a copy of it.
          * 
-         * Keep in mind that this will only search *this* node's *children*, it will not return the current node.
+         * Null until the first child is appended.
          */
-        std::vector<Node*> QuerySelector(const std::string& selector)
-        {
-            std::vector<SelectorToken> tokens = parse_selector(selector);
-            std::vector<SelectorGroup> groups;
-            size_t currentGroup = 0;
+        ChildListHandle m_children;
 
-            // start by pushing an initial group that spans the whole selector token vector, this will be updated if
-            // there are other groups in this vector 
-            groups.push_back(SelectorGroup(tokens.begin(), tokens.end()));
+        /**
+         * The attributes for a node, in the order they were first set.
+         * 
+         * This is only used for elements.
+         */
+        AttributeList m_attributes;
+    };
 
-            for (size_t index = 0; index < tokens.size(); index++)
-            {
-                auto& token = tokens.at(index);
+    inline StaticFragment::StaticFragment(const Node& node, ToStringOptions options)
+        : m_bytes(std::make_shared<const std::string>(node.ToString(options))) {}
 
-                if (token.type == SelectorTokenType::SELECTOR_SEPARATOR)
-                {
-                    // end this group at the previous token
-                    groups[currentGroup].end = tokens.begin() + (index - 1);
+    /**
+     * An enum for the kinds of operation in a patch between two trees.
+     */
+    enum class PatchType : uint8_t
+    {
+        INSERT,           // Insert the node of the operation as the child at the index at the end of the path
+        REMOVE,           // Remove the child at the index at the end of the path
+        REPLACE,          // Replace the node at the path with the node of the operation
+        REPLACE_TEXT,     // Set the content of the text node at the path to the value
+        SET_ATTRIBUTE,    // Set the attribute with the name to the value, escaped for the context
+        REMOVE_ATTRIBUTE, // Remove the attribute with the name
+        TOGGLE_CLASS,     // Toggle the class with the name
+    };
 
-                    // create a new group at the token after this one (if the vector has more)
-                    if (tokens.size() <= index + 1)
-                    {
-                        break;
-                    }
+    /**
+     * A single operation in a patch between two trees, made with Diff.
+     * 
+     * The path is the index of each child from the root of the tree down to the node that the operation applies to,
+     * so the path of the root itself is empty. Each path refers to the tree as it is after the operations before it.
+     */
+    struct PatchOperation
+    {
+        PatchType           type    = PatchType::INSERT;
+        std::vector<size_t> path;
+        std::string         name    = "";
+        std::string         value   = "";
+        EscapeContext       context = EscapeContext::HTML;
+
+        // the node that is inserted or replaces another
+        std::shared_ptr<const Node> node;
+
+        PatchOperation(
+            PatchType type=PatchType::INSERT,
+            std::vector<size_t> path={},
+            std::string name="",
+            std::string value="",
+            EscapeContext context=EscapeContext::HTML)
+            : type(type)
+            , path(std::move(path))
+            , name(std::move(name))
+            , value(std::move(value))
+            , context(context) {}
+    };
+
+    /**
+     * Return the operations that change the tree before into the tree after, in the order they are applied in.
+     * 
+     * Children with an id are matched to the child with the same id, and other children are matched to an equal
+     * child first and in order otherwise, so moving a child with an id only removes and inserts that child. Subtrees
+     * with the same content hash are never walked, so diffing two copies of a large tree with a small change only
+     * visits the nodes above the change.
+     */
+    inline std::vector<PatchOperation> Diff(const Node& before, const Node& after)
+    {
+        std::vector<PatchOperation> operations;
+        std::vector<size_t> path;
 
-                    groups.push_back(SelectorGroup(tokens.begin() + (index + 1), tokens.end()));
+        Node::DiffNode(before, after, path, operations);
 
-                    currentGroup++;
-                }
-            }
+        return operations;
+    }
 
-            std::vector<Node*> matches;
+    /**
+     * Apply the operations from Diff to the node passed in, in order.
+     * 
+     * Applying the diff of two trees to a copy of the first tree makes it equal to the second.
+     */
+    inline void Patch(Node& root, const std::vector<PatchOperation>& operations)
+    {
+        for (const auto& operation : operations)
+        {
+            Node* parent = nullptr;
+            Node* target = &root;
 
-            // now that we have selector groups, we can start our search for matches
-            for (auto& child : m_children)
+            for (size_t index : operation.path)
             {
-                std::vector<Node*> submatches = child.GetSelectorMatches(groups, 0);
+                parent = target;
 
-                matches.insert(matches.end(), submatches.begin(), submatches.end());
+                // an insert may point just past the last child, where there is no node yet
+                target = (index < parent->ChildCount()) ? &parent->GetChild(index) : nullptr;
             }
 
-            return matches;
+            switch (operation.type)
+            {
+                case PatchType::INSERT:
+                    if (parent == nullptr)
+                        break;
+
+                    if (target != nullptr)
+                        target->InsertBefore(*operation.node);
+                    else
+                        parent->AppendChild(*operation.node);
+
+                    break;
+                case PatchType::REMOVE:
+                    if (target != nullptr && parent != nullptr)
+                        target->Remove();
+
+                    break;
+                case PatchType::REPLACE:
+                    if (target != nullptr)
+                        *target = *operation.node;
+
+                    break;
+                case PatchType::REPLACE_TEXT:
+                    if (target != nullptr)
+                        target->SetContent(operation.value);
+
+                    break;
+                case PatchType::SET_ATTRIBUTE:
+                    if (target != nullptr)
+                        target->SetAttribute(operation.name, operation.value, operation.context);
+
+                    break;
+                case PatchType::REMOVE_ATTRIBUTE:
+                    if (target != nullptr)
+                        target->RemoveAttribute(operation.name);
+
+                    break;
+                case PatchType::TOGGLE_CLASS:
+                    if (target != nullptr)
+                        target->ToggleClass(operation.name);
+
+                    break;
+            }
         }
+    }
 
-        /**
-         * Set whether or not this element should have a closing tag or not.
-         */
-        Node& UseClosingTag(bool close)
+    inline void Node::DiffNode(const Node& before, const Node& after, std::vector<size_t>& path, std::vector<PatchOperation>& operations)
+    {
+        // equal subtrees need no operations, which is found without walking them
+        if (before.Hash() == after.Hash())
+            return;
+
+        if (before.m_type == NodeType::TEXT && after.m_type == NodeType::TEXT && before.m_trusted == after.m_trusted)
         {
-            this->m_closeTag = close;
+            operations.push_back(PatchOperation(PatchType::REPLACE_TEXT, path, "", after.m_content));
 
-            return *this;
+            return;
         }
 
-        /**
-         * Get the vector of child nodes from this node instance.
-         */
-        std::vector<Node> GetChildren()
+        bool replace = before.m_type != NodeType::ELEMENT ||
+                       after.m_type != NodeType::ELEMENT ||
+                       before.m_name != after.m_name ||
+                       before.m_closeTag != after.m_closeTag;
+
+        // attributes that are left to template slots can not be set by a patch
+        for (const auto& attr : after.m_attributes)
         {
-            return m_children;
+            const Attribute* previous = before.m_attributes.Get(attr.name);
+
+            if (!attr.slot.empty() && (previous == nullptr || previous->slot != attr.slot))
+                replace = true;
         }
 
-    protected:
-        /**
-         * Check if any child nodes within this Node match the selector group passed in.
-         * 
-         * Any matches will be in the returned vector. 
-         */
-        std::vector<Node*> GetSelectorMatches(std::vector<SelectorGroup>& groups, size_t currentIndex)
+        if (replace)
         {
-            std::vector<Node*> matches;
+            PatchOperation operation(PatchType::REPLACE, path);
 
-            auto& group = groups.at(currentIndex);
-            
-            for (auto& node : m_children)
-            {
-                if (node.SelectorMatch(group.begin, group.end))
-                {
-                    // check if this is the last group, if so, add this node to the vector
-                    if (currentIndex + 1 == groups.size())
-                    {
-                        matches.push_back(&node);
-                    }
-                    else
-                    {
-                        std::vector<Node*> submatches = node.GetSelectorMatches(groups, currentIndex + 1);
+            operation.node = std::make_shared<const Node>(after);
 
-                        matches.insert(matches.end(), submatches.begin(), submatches.end());
-                    }
-                }
+            operations.push_back(std::move(operation));
 
-                // we still want to search from the beginning of the selector on this node to recurse, so run this
-                // method again but instead with the currentIndex at 0 to restart the search at this node
-                std::vector<Node*> recurse = node.GetSelectorMatches(groups, 0);
-                
-                matches.insert(matches.end(), recurse.begin(), recurse.end());
-            }
+            return;
+        }
 
-            return matches;
+        DiffAttributes(before, after, path, operations);
+
+        DiffChildren(before, after, path, operations);
+    }
+
+    inline void Node::DiffAttributes(const Node& before, const Node& after, std::vector<size_t>& path, std::vector<PatchOperation>& operations)
+    {
+        if (before.m_id != after.m_id)
+        {
+            if (after.m_id.empty())
+                operations.push_back(PatchOperation(PatchType::REMOVE_ATTRIBUTE, path, "id"));
+            else
+                operations.push_back(PatchOperation(PatchType::SET_ATTRIBUTE, path, "id", after.m_id));
         }
 
-        /**
-         * Compares the current node to a list of tokens represented by a begin and end iterator.
-         */
-        bool SelectorMatch(SelectorTokenItr begin, SelectorTokenItr end)
+        // toggling adds a class at the end of the list, so toggles only give the same order as the element after
+        // when the classes that are kept come first, and the whole class list is set otherwise
+        std::vector<std::string> toggled;
+
+        for (const auto& className : before.m_classes)
         {
-            // variable used for storing name of an attribute for checking against
-            std::string attribName = "";
+            if (std::find(after.m_classes.begin(), after.m_classes.end(), className) != after.m_classes.end())
+                toggled.push_back(className);
+        }
 
-            // comparison method used for this particular attribute, set to NONE when not an attrib
-            AttributeComparisonType attribComp = AttributeComparisonType::NONE;
+        for (const auto& className : after.m_classes)
+        {
+            if (std::find(before.m_classes.begin(), before.m_classes.end(), className) == before.m_classes.end())
+                toggled.push_back(className);
+        }
 
-            for (auto& itr = begin; itr != end; ++itr)
+        if (toggled.size() == after.m_classes.size() && std::equal(toggled.begin(), toggled.end(), after.m_classes.begin()))
+        {
+            for (const auto& className : before.m_classes)
             {
-                if (itr->type == SelectorTokenType::ELEMENT && itr->value != m_name)
-                {
-                    return false;
-                }
+                if (std::find(after.m_classes.begin(), after.m_classes.end(), className) == after.m_classes.end())
+                    operations.push_back(PatchOperation(PatchType::TOGGLE_CLASS, path, className));
+            }
 
-                if (itr->type == SelectorTokenType::ID && itr->value != m_id)
-                {
-                    return false;
-                }
+            for (const auto& className : after.m_classes)
+            {
+                if (std::find(before.m_classes.begin(), before.m_classes.end(), className) == before.m_classes.end())
+                    operations.push_back(PatchOperation(PatchType::TOGGLE_CLASS, path, className));
+            }
+        }
+        else
+        {
+            std::string classes;
 
-                if (itr->type == SelectorTokenType::ATTRIBUTE_NAME)
-                {
-                    attribName = itr->value;
+            for (const auto& className : after.m_classes)
+            {
+                if (!classes.empty())
+                    classes += " ";
 
-                    continue;
-                }
+                classes += className;
+            }
 
-                if (itr->type == SelectorTokenType::ATTRIBUTE_COMPARE)
-                {
-                    attribComp = itr->comparison;
-                    
-                    continue;
-                }
+            operations.push_back(PatchOperation(PatchType::SET_ATTRIBUTE, path, "class", classes));
+        }
 
-                if (itr->type == SelectorTokenType::CLASS)
-                {
-                    auto find = std::find_if(m_classes.begin(), m_classes.end(), [&](const std::string& cls) {
-                        return cls == itr->value;
-                    });
+        // attributes keep their position when they are set again and new ones are added at the end, so the same
+        // holds for attributes as for classes, and every attribute is removed and set again when the order changes
+        std::vector<const std::string*> order;
 
-                    if (find == m_classes.end())
-                    {
-                        return false;
-                    }
-                }
+        for (const auto& attr : before.m_attributes)
+        {
+            if (after.m_attributes.Get(attr.name) != nullptr)
+                order.push_back(&attr.name);
+        }
 
-                if (itr->type == SelectorTokenType::ATTRIBUTE_VALUE)
-                {
-                    auto find = std::find_if(m_attributes.begin(), m_attributes.end(), [&](std::pair<std::string, std::string> val) {
-                        if (val.first != attribName)
-                        {
-                            return false;
-                        }
+        for (const auto& attr : after.m_attributes)
+        {
+            if (before.m_attributes.Get(attr.name) == nullptr)
+                order.push_back(&attr.name);
+        }
+
+        bool ordered = order.size() == after.m_attributes.size();
+
+        for (size_t index = 0; ordered && index < order.size(); index++)
+            ordered = *order[index] == (after.m_attributes.begin() + index)->name;
+
+        for (const auto& attr : before.m_attributes)
+        {
+            if (!ordered || after.m_attributes.Get(attr.name) == nullptr)
+                operations.push_back(PatchOperation(PatchType::REMOVE_ATTRIBUTE, path, attr.name));
+        }
+
+        for (const auto& attr : after.m_attributes)
+        {
+            const Attribute* previous = before.m_attributes.Get(attr.name);
 
-                        if (attribComp == AttributeComparisonType::ATTRIBUTE_EQUAL && val.second != itr->value)
-                        {
-                            return false;
-                        }
+            // setting the value also clears a slot that the attribute was left to before
+            if (!ordered || previous == nullptr || previous->value != attr.value || previous->context != attr.context ||
+                previous->slot != attr.slot)
+            {
+                operations.push_back(PatchOperation(PatchType::SET_ATTRIBUTE, path, attr.name, attr.value, attr.context));
+            }
+        }
+    }
 
-                        if (attribComp == AttributeComparisonType::ATTRIBUTE_CONTAINS)
-                        {
-                            auto contains = val.second.find(itr->value);
+    inline void Node::DiffChildren(const Node& before, const Node& after, std::vector<size_t>& path, std::vector<PatchOperation>& operations)
+    {
+        std::vector<const Node*> previous;
+        std::vector<const Node*> next;
 
-                            if (contains == std::string::npos)
-                            {
-                                return false;
-                            }
-                        }
+        for (const Node* child = before.FirstChild(); child != nullptr; child = child->NextSibling())
+            previous.push_back(child);
 
-                        if (attribComp == AttributeComparisonType::ATTRIBUTE_STARTS_WITH && !string_starts_with(val.second, itr->value))
-                        {
-                            return false;
-                        }
+        for (const Node* child = after.FirstChild(); child != nullptr; child = child->NextSibling())
+            next.push_back(child);
 
-                        if (attribComp == AttributeComparisonType::ATTRIBUTE_ENDS_WITH && !string_ends_with(val.second, itr->value))
-                        {
-                            return false;   
-                        }
+        const size_t NO_MATCH = std::string::npos;
 
-                        if (attribComp == AttributeComparisonType::ATTRIBUTE_CONTAINS_WORD && !string_contains_word(val.second, itr->value))
-                        {
-                            return false;   
-                        }
+        // the child before that each child after is matched to
+        std::vector<size_t> matches(next.size(), NO_MATCH);
+        std::vector<bool> matched(previous.size(), false);
 
-                        if (attribComp == AttributeComparisonType::ATTRIBUTE_IS_OR_BEGIN_HYPHEN && !string_is_or_begin_hyphen(val.second, itr->value))
-                        {
-                            return false;   
-                        }
+        std::unordered_map<std::string, size_t> ids;
+        std::unordered_multimap<uint64_t, size_t> hashes;
 
-                        return true;
-                    });
+        for (size_t index = 0; index < previous.size(); index++)
+        {
+            if (!previous[index]->m_id.empty())
+                ids.emplace(previous[index]->m_id, index);
+            else
+                hashes.emplace(previous[index]->Hash(), index);
+        }
 
-                    if (find == m_attributes.end())
-                    {
-                        return false;
-                    }
+        // children with an id are matched by their id, and other children to an equal child where there is one
+        for (size_t index = 0; index < next.size(); index++)
+        {
+            if (!next[index]->m_id.empty())
+            {
+                auto find = ids.find(next[index]->m_id);
 
-                    attribName.clear();
-                    attribComp = AttributeComparisonType::NONE;
+                if (find != ids.end() && !matched[find->second])
+                {
+                    matches[index] = find->second;
+                    matched[find->second] = true;
                 }
+
+                continue;
             }
 
-            return true;
+            auto range = hashes.equal_range(next[index]->Hash());
+
+            for (auto find = range.first; find != range.second; ++find)
+            {
+                if (!matched[find->second] && (matches[index] == NO_MATCH || find->second < matches[index]))
+                    matches[index] = find->second;
+            }
+
+            if (matches[index] != NO_MATCH)
+                matched[matches[index]] = true;
         }
 
-        /**
-         * Set the name of this element from a vector of selector tokens.
-         * 
-         * Used internally by SetName(const std::string&) for nested node creation with selectors.
-         */
-        Node& SetName(std::vector<SelectorToken>&& tokens)
+        // the rest of the children without an id are matched in order to children of the same kind
+        size_t scan = 0;
+
+        for (size_t index = 0; index < next.size(); index++)
         {
-            bool firstToken = true;
-            bool skipNext   = false;
+            if (matches[index] != NO_MATCH)
+            {
+                if (matches[index] >= scan)
+                    scan = matches[index] + 1;
+
+                continue;
+            }
+
+            if (!next[index]->m_id.empty())
+                continue;
 
-            for (size_t index = 0; index < tokens.size(); index++)
+            for (size_t candidate = scan; candidate < previous.size(); candidate++)
             {
-                if (skipNext)
-                {
-                    skipNext = false;
+                const Node* child = previous[candidate];
 
+                if (matched[candidate] || !child->m_id.empty())
                     continue;
-                }
 
-                SelectorToken& token = tokens.at(index);
-
-                // this could be an odd way to handle this, but for supporting creating multiple nested elements
-                // from a name selector, just check if we are at one such separator, then create a new node from
-                // the remaining subset of tokens that were parsed.
-                if (token.type == SelectorTokenType::SELECTOR_SEPARATOR && tokens.size() > index + 1)
+                if (child->m_type == next[index]->m_type && child->m_name == next[index]->m_name)
                 {
-                    Node childNode;
-                    childNode.SetName(std::vector<SelectorToken>(tokens.begin() + (index + 1), tokens.end()));
+                    matches[index] = candidate;
+                    matched[candidate] = true;
 
-                    this->AppendChild(childNode);
+                    scan = candidate + 1;
 
                     break;
                 }
+            }
+        }
 
-                // Cannot continue with selector if the first element is not
-                // an actual element name token
-                if (firstToken && token.type != SelectorTokenType::ELEMENT)
-                    break;
+        // only matches that keep their order can be kept without moving them, so keep the longest run of matches in
+        // increasing order, and remove and insert the rest
+        std::vector<size_t> tails;
+        std::vector<size_t> links(next.size(), NO_MATCH);
 
-                // For this method, only allow one name to be used at a time
-                // thus any other name token will overwrite the name used.
-                if (token.type == SelectorTokenType::ELEMENT)
-                    this->m_name = token.value;
+        for (size_t index = 0; index < next.size(); index++)
+        {
+            if (matches[index] == NO_MATCH)
+                continue;
 
-                // Add to the class list when a class token is hit
-                if (token.type == SelectorTokenType::CLASS)
-                    this->m_classes.push_back(token.value);
+            size_t low  = 0;
+            size_t high = tails.size();
 
-                // Overwrite the current ID if that token is hit
-                if (token.type == SelectorTokenType::ID)
-                    this->m_id = token.value;
+            while (low < high)
+            {
+                size_t middle = (low + high) / 2;
 
-                // Attributes are special in that the value can be ommitted for
-                // a blank attribute, since that is still valid, a lookahead is
-                // performed and if the value is found as the next token, it is
-                // added to the attribute map and the next token is skipped.
-                //
-                // otherwise, the blank token is added
-                if (token.type == SelectorTokenType::ATTRIBUTE_NAME)
-                {
-                    std::string attrValue = "";
+                if (matches[tails[middle]] < matches[index])
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
 
-                    // try and get the token after the ATTRIBUTE_COMPARE token as a lookahead
-                    // for construction, the compare token is ignored to just set the token value
-                    if (tokens.size() > index + 2)
-                    {
-                        SelectorToken& next = tokens.at(index + 2);
-                    
-                        // found a value token, set the value string and skip
-                        // this token after adding the attribute
-                        if (next.type == SelectorTokenType::ATTRIBUTE_VALUE)
-                        {
-                            attrValue = next.value;
-                        
-                            skipNext = true;
-                        }
-                    }
+            if (low > 0)
+                links[index] = tails[low - 1];
 
-                    m_attributes[token.value] = std::move(attrValue);
-                }
+            if (low == tails.size())
+                tails.push_back(index);
+            else
+                tails[low] = index;
+        }
 
-                if (firstToken)
-                    firstToken = false;
-            }
+        std::vector<bool> kept(previous.size(), false);
+        std::vector<size_t> keptMatches(next.size(), NO_MATCH);
 
-            return *this;
+        for (size_t index = tails.empty() ? NO_MATCH : tails.back(); index != NO_MATCH; index = links[index])
+        {
+            kept[matches[index]] = true;
+            keptMatches[index]   = matches[index];
         }
 
-    private:
-        /**
-         * The parent node for this Node instance.
-         * 
-         * This is stored for purposes of removing the node and should be set
-         * on an AppendChild call.
-         */
-        Node* m_parent = nullptr;
+        // remove from the end, so that the index of every child that is left to remove stays the same
+        for (size_t index = previous.size(); index-- > 0;)
+        {
+            if (kept[index])
+                continue;
 
-        /**
-         * The type of Node for this instance.
-         * 
-         * Defaults to an ELEMENT.
-         */
-        NodeType m_type = NodeType::ELEMENT;
+            path.push_back(index);
 
-        /**
-         * The name of the current node.
-         * 
-         * Only used in elements, and represents a tag name such as `div`.
-         */
-        std::string m_name = "";
+            operations.push_back(PatchOperation(PatchType::REMOVE, path));
 
-        /**
-         * A list of classes for the current Node.
-         * 
-         * Only used with an element type node.
-         */
-        std::vector<std::string> m_classes;
+            path.pop_back();
+        }
 
-        /**
-         * A singular ID for this element.
-         */
-        std::string m_id = "";
+        // every child before the one at an index is in place by the time it is reached, so the index is the same as
+        // the index in the node after
+        for (size_t index = 0; index < next.size(); index++)
+        {
+            path.push_back(index);
 
-        /**
-         * The content for this Node instance.
-         * 
-         * Only used for text and document type nodes. For text it is the actual
-         * content that is sent when converting to a string. For a document type
-         * it is the actual type to set, such as `html`.
-         */
-        std::string m_content = "";
+            if (keptMatches[index] != NO_MATCH)
+                DiffNode(*previous[keptMatches[index]], *next[index], path, operations);
+            else
+            {
+                PatchOperation operation(PatchType::INSERT, path);
 
-        /**
-         * Whether or not to close this current Node if it is an element.
-         * 
-         * If this is false, no children are to be printed after the node
-         * as there would be nowhere to place them.
-         * 
-         * Defaults to true.
-         */
-        bool m_closeTag = true;
+                operation.node = std::make_shared<const Node>(*next[index]);
 
-        /**
-         * The child nodes of this Node instance.
-         */
-        std::vector<Node> m_children;
+                operations.push_back(std::move(operation));
+            }
 
-        /**
-         * A map of attribute keys to values for a node.
-         * 
-         * This is only used for elements.
-         */
-        std::unordered_map<std::string, std::string> m_attributes;
-    };
+            path.pop_back();
+        }
+    }
+
+    class FrozenDocument;
 
     /**
      * A simple class that represents a HTML5 document with an <html> tag
@@ -1481,13 +6257,31 @@ namespace CTML
          */
         std::string ToString(ToStringOptions options={}) const
         {
-            std::stringstream output;
+            std::string output;
 
-            output << m_doctype.ToString(options);
+            this->AppendToString(output, options);
 
-            output << m_html.ToString(options);
+            return output;
+        }
 
-            return output.str();
+        /**
+         * Append the entire document as a string to the end of the output passed in.
+         */
+        void AppendToString(std::string& output, const ToStringOptions& options) const
+        {
+            m_doctype.AppendToString(output, options);
+
+            m_html.AppendToString(output, options);
+        }
+
+        /**
+         * Return a 64-bit hash of the content of the entire document, without rendering it.
+         * 
+         * See Node::Hash for how the hash is computed and cached.
+         */
+        uint64_t Hash() const
+        {
+            return content_hash_finish(content_hash_round(m_doctype.Hash(), m_html.Hash()));
         }
 
         /**
@@ -1500,6 +6294,33 @@ namespace CTML
             return m_html.QuerySelector(selector);
         }
 
+        /**
+         * Searches a selector from the root of the document, without changing the document.
+         */
+        std::vector<const Node*> QuerySelector(const std::string& selector) const
+        {
+            return m_html.QuerySelector(selector);
+        }
+
+        /**
+         * Searches for several selectors from the root of the document in a single traversal.
+         * 
+         * Essentially shorthand for document.html().QuerySelectorAll(const std::vector<std::string>&).
+         */
+        std::vector<std::vector<Node*>> QuerySelectorAll(const std::vector<std::string>& selectors)
+        {
+            return m_html.QuerySelectorAll(selectors);
+        }
+
+        /**
+         * Searches for several selectors from the root of the document in a single traversal, without changing the
+         * document.
+         */
+        std::vector<std::vector<const Node*>> QuerySelectorAll(const std::vector<std::string>& selectors) const
+        {
+            return m_html.QuerySelectorAll(selectors);
+        }
+
         /**
          * Return the root HTML document node.
          */
@@ -1508,6 +6329,14 @@ namespace CTML
             return m_html;
         }
 
+        /**
+         * Return the root HTML document node, without changing the document.
+         */
+        const Node& html() const
+        {
+            return m_html;
+        }
+
         /**
          * Return the head element for the document.
          */
@@ -1516,6 +6345,14 @@ namespace CTML
             return m_html.GetChildByName("head");
         }
 
+        /**
+         * Return the head element for the document, without changing the document.
+         */
+        const Node& head() const
+        {
+            return m_html.GetChildByName("head");
+        }
+
         /**
          * Return the body element for the document.
          */
@@ -1524,6 +6361,21 @@ namespace CTML
             return m_html.GetChildByName("body");
         }
 
+        /**
+         * Return the body element for the document, without changing the document.
+         */
+        const Node& body() const
+        {
+            return m_html.GetChildByName("body");
+        }
+
+        /**
+         * Take an immutable snapshot of this document, rendered ahead of time with the options passed in.
+         * 
+         * See FrozenDocument for more info.
+         */
+        FrozenDocument Freeze(ToStringOptions options={}) const;
+
     private:
         /**
          * The doctype node for this document.
@@ -1538,5 +6390,112 @@ namespace CTML
         Node m_html;
 
     };
+
+    /**
+     * An immutable snapshot of a document, for rendering and searching the same document many times.
+     * 
+     * The snapshot is rendered once when it is taken, so rendering it with the same options just returns the bytes
+     * from then, while other options render the tree into a buffer that is already sized for the output. Nothing in
+     * a snapshot can change, so it can be shared between threads freely, and copies of it share the same tree and
+     * bytes.
+     * 
+     * Taking a snapshot does not copy the tree, as the snapshot shares its children with the document until the
+     * document is changed, which then copies just the children it changes.
+     */
+    class FrozenDocument
+    {
+    public:
+        /**
+         * Take a snapshot of the document passed in, rendered with the options passed in.
+         */
+        FrozenDocument(const Document& document, ToStringOptions options={})
+            : m_document(std::make_shared<const Document>(document))
+            , m_bytes(std::make_shared<const std::string>(m_document->ToString(options)))
+            , m_options(options) {}
+
+        /**
+         * Get the document as it was rendered when the snapshot was taken.
+         */
+        const std::string& ToString() const
+        {
+            return *m_bytes;
+        }
+
+        /**
+         * Get the document as a string with the options passed in.
+         */
+        std::string ToString(ToStringOptions options) const
+        {
+            if (options.formatting == m_options.formatting &&
+                options.trailingNewline == m_options.trailingNewline &&
+                options.indentLevel == m_options.indentLevel &&
+                options.escapeContent == m_options.escapeContent &&
+                options.encoding == m_options.encoding)
+            {
+                return *m_bytes;
+            }
+
+            std::string output;
+
+            output.reserve(m_bytes->size());
+
+            m_document->AppendToString(output, options);
+
+            return output;
+        }
+
+        /**
+         * Get the number of bytes in the document as it was rendered when the snapshot was taken.
+         */
+        size_t Size() const
+        {
+            return m_bytes->size();
+        }
+
+        /**
+         * Searches a selector from the root of the snapshot.
+         */
+        std::vector<const Node*> QuerySelector(const std::string& selector) const
+        {
+            return m_document->QuerySelector(selector);
+        }
+
+        /**
+         * Searches for several selectors from the root of the snapshot in a single traversal.
+         */
+        std::vector<std::vector<const Node*>> QuerySelectorAll(const std::vector<std::string>& selectors) const
+        {
+            return m_document->QuerySelectorAll(selectors);
+        }
+
+        /**
+         * Return the document that the snapshot holds.
+         */
+        const Document& GetDocument() const
+        {
+            return *m_document;
+        }
+
+    private:
+        /**
+         * The document in the snapshot, which is never changed.
+         */
+        std::shared_ptr<const Document> m_document;
+
+        /**
+         * The document as it was rendered when the snapshot was taken.
+         */
+        std::shared_ptr<const std::string> m_bytes;
+
+        /**
+         * The options that the document was rendered with.
+         */
+        ToStringOptions m_options;
+    };
+
+    inline FrozenDocument Document::Freeze(ToStringOptions options) const
+    {
+        return FrozenDocument(*this, options);
+    }
 }
 #endif
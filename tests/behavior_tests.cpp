@@ -57,11 +57,7 @@ TEST_CASE("nodes behave correctly", "[node_behavior]")
             .SetAttribute("src", "image.png")
             .UseClosingTag(false);
 
-        // attribute order does not matter, so just have both orders potentially for this case
-        bool nodeStrEqual = (node.ToString() == "<img src=\"image.png\" alt=\"an image\">") ||
-                            (node.ToString() == "<img alt=\"an image\" src=\"image.png\">");
-
-        REQUIRE(nodeStrEqual == true);
+        REQUIRE(node.ToString() == "<img alt=\"an image\" src=\"image.png\">");
     }
 
     SECTION("remove child by index")
@@ -99,11 +95,7 @@ TEST_CASE("nodes behave correctly", "[node_behavior]")
         node.SetAttribute("title", "\"Hello world\"")
             .SetAttribute("onclick", "<onclick()>");
 
-        // attribute order does not matter for this test case, so have both orders for this check
-        bool nodeStrEquals = (node.ToString() == "<p onclick=\"&lt;onclick()&gt;\" title=\"&quot;Hello world&quot;\">Hello world!</p>") ||
-                             (node.ToString() == "<p title=\"&quot;Hello world&quot;\" onclick=\"&lt;onclick()&gt;\">Hello world!</p>");
-
-        REQUIRE(nodeStrEquals == true);
+        REQUIRE(node.ToString() == "<p title=\"&quot;Hello world&quot;\" onclick=\"&lt;onclick()&gt;\">Hello world!</p>");
     }
 
     SECTION("blank attribute output as name only")
@@ -256,4 +248,982 @@ TEST_CASE("nodes behave correctly", "[node_behavior]")
 
         REQUIRE(matches.size() == 2);
     }
-}
\ No newline at end of file
+
+    SECTION("static fragments render their shared bytes")
+    {
+        CTML::Node nav("nav");
+
+        nav.AppendChild(CTML::Node("a.home", "Home & Away"));
+
+        CTML::StaticFragment fragment(nav);
+
+        // changing the source node afterwards should not change the fragment
+        nav.AppendText("changed");
+
+        CTML::Node first("header");
+        CTML::Node second("footer");
+
+        first.AppendChild(fragment);
+        second.AppendChild(fragment).AppendText("!");
+
+        REQUIRE(first.ToString() == "<header><nav><a class=\"home\">Home &amp; Away</a></nav></header>");
+        REQUIRE(second.ToString() == "<footer><nav><a class=\"home\">Home &amp; Away</a></nav>!</footer>");
+        REQUIRE(fragment.Buffer().use_count() == 3);
+        REQUIRE(second.QuerySelector("a").empty());
+    }
+
+    SECTION("copies share children until one of them is changed")
+    {
+        CTML::Node widget("div.widget>ul>li*3");
+
+        CTML::Node first("section");
+        CTML::Node second("section");
+
+        first.AppendChild(widget);
+        second.AppendChild(widget);
+
+        // changing one of the copies should leave the other and the original alone
+        auto items = first.QuerySelector("li");
+
+        REQUIRE(items.size() == 3);
+
+        items.front()->AppendText("changed");
+
+        REQUIRE(first.ToString() == "<section><div class=\"widget\"><ul><li>changed</li><li></li><li></li></ul></div></section>");
+        REQUIRE(second.ToString() == "<section><div class=\"widget\"><ul><li></li><li></li><li></li></ul></div></section>");
+        REQUIRE(widget.ToString() == "<div class=\"widget\"><ul><li></li><li></li><li></li></ul></div>");
+    }
+
+    SECTION("searching a copy only copies the children above the matches")
+    {
+        CTML::Node page("main");
+
+        page.AppendChild(CTML::Node("section.one>ul>li*50"))
+            .AppendChild(CTML::Node("section.two>ul>li#target"));
+
+        CTML::Node copy = page;
+
+        std::vector<CTML::Node*> matches = copy.QuerySelector("#target");
+
+        REQUIRE(matches.size() == 1);
+
+        matches.front()->AppendText("found");
+
+        const CTML::Node& original = page;
+        const CTML::Node& searched = copy;
+
+        // the list of the section without a match is still shared, while the path to the match was copied
+        REQUIRE(searched.GetChild(0).FirstChild() == original.GetChild(0).FirstChild());
+        REQUIRE(searched.GetChild(1).FirstChild() != original.GetChild(1).FirstChild());
+
+        REQUIRE(page.QuerySelector("#target").front()->ChildCount() == 0);
+        REQUIRE(copy.ToString().find("<li id=\"target\">found</li>") != std::string::npos);
+    }
+
+    SECTION("pointers taken before a copy only change the original")
+    {
+        CTML::Node list("ul>li*3");
+
+        CTML::Node* item = list.FirstChild();
+        CTML::Node* last = list.LastChild();
+
+        CTML::Node copy = list;
+
+        const uint64_t hash = copy.Hash();
+
+        item->SetAttribute("k", "v");
+
+        REQUIRE(list.ToString() == "<ul><li k=\"v\"></li><li></li><li></li></ul>");
+        REQUIRE(copy.ToString() == "<ul><li></li><li></li><li></li></ul>");
+        REQUIRE(copy.Hash() == hash);
+        REQUIRE(list.Hash() != hash);
+
+        last->Remove();
+
+        REQUIRE(list.ChildCount() == 2);
+        REQUIRE(copy.ChildCount() == 3);
+
+        // moving a node takes the children along, so the pointers to them now change the node they were moved to
+        CTML::Node page("main");
+
+        item = copy.FirstChild();
+
+        page.AppendChild(std::move(copy));
+
+        const uint64_t moved = page.Hash();
+
+        item->SetAttribute("k", "w");
+
+        REQUIRE(page.ToString() == "<main><ul><li k=\"w\"></li><li></li><li></li></ul></main>");
+        REQUIRE(page.Hash() != moved);
+        REQUIRE(copy.ChildCount() == 0);
+        REQUIRE(std::is_nothrow_move_constructible<CTML::Node>::value);
+        REQUIRE(std::is_nothrow_move_assignable<CTML::Node>::value);
+    }
+
+    SECTION("copied documents are independent")
+    {
+        CTML::Document document;
+
+        document.AppendNodeToBody(CTML::Node("p", "original"));
+
+        CTML::Document copy = document;
+
+        copy.AppendNodeToBody(CTML::Node("p", "copy"));
+
+        REQUIRE(document.ToString() == "<!DOCTYPE html><html><head></head><body><p>original</p></body></html>");
+        REQUIRE(copy.ToString() == "<!DOCTYPE html><html><head></head><body><p>original</p><p>copy</p></body></html>");
+    }
+
+    SECTION("children can be walked without copying")
+    {
+        CTML::Node node("ul>li.item$*3");
+
+        REQUIRE(node.ChildCount() == 3);
+        REQUIRE(node.GetChild(1).GetAttribute("class") == "item2");
+        REQUIRE(node.FirstChild()->GetAttribute("class") == "item1");
+        REQUIRE(node.LastChild()->GetAttribute("class") == "item3");
+
+        const CTML::Node& constNode = node;
+
+        size_t count = 0;
+
+        for (const auto& child : constNode.Children())
+        {
+            REQUIRE(child.Name() == "li");
+
+            count++;
+        }
+
+        REQUIRE(count == 3);
+
+        for (auto& child : node.Children())
+            child.AppendText("x");
+
+        REQUIRE(node.ToString() == "<ul><li class=\"item1\">x</li><li class=\"item2\">x</li><li class=\"item3\">x</li></ul>");
+        REQUIRE(CTML::Node("p").FirstChild() == nullptr);
+    }
+
+    SECTION("remove does nothing once the appended copy is gone")
+    {
+        CTML::Node parent("div");
+        CTML::Node handle("a");
+
+        parent.AppendChild(handle);
+        parent.RemoveChild(0);
+
+        // the new child may reuse the address of the copy, which must not make it the one removed
+        parent.AppendChild(CTML::Node("b"));
+
+        handle.Remove();
+
+        REQUIRE(parent.ToString() == "<div><b></b></div>");
+
+        // a handle that outlives its parent has nothing to remove either
+        CTML::Node orphan("p");
+
+        {
+            CTML::Node scope("section");
+
+            scope.AppendChild(orphan);
+        }
+
+        orphan.Remove();
+
+        REQUIRE(orphan.ToString() == "<p></p>");
+    }
+
+    SECTION("remove finds a node by identity")
+    {
+        CTML::Node node("div>p*3");
+
+        // every child has the same selector, so only identity can pick the middle one
+        node.GetChild(1).AppendText("middle");
+        node.GetChild(1).Remove();
+
+        REQUIRE(node.ToString() == "<div><p></p><p></p></div>");
+    }
+
+    SECTION("query results stay valid across unrelated changes")
+    {
+        CTML::Node page("div");
+
+        page.AppendChild(CTML::Node("ul>li.first"));
+
+        CTML::Node* list = page.FirstChild();
+        CTML::Node* first = page.QuerySelector(".first").front();
+
+        // enough appends that a contiguous container would have moved its elements
+        for (size_t index = 0; index < 64; index++)
+            list->AppendChild(CTML::Node("li"));
+
+        first->AppendText("still here");
+
+        REQUIRE(list->FirstChild() == first);
+        REQUIRE(list->GetChild(0).ToString() == "<li class=\"first\">still here</li>");
+    }
+
+    SECTION("searches match the direct children but not the node itself")
+    {
+        CTML::Node list("ul.menu>li.item+li.item>a.item");
+
+        REQUIRE(list.QuerySelector(".item").size() == 3);
+        REQUIRE(list.QuerySelector(".item").front() == list.FirstChild());
+        REQUIRE(list.QuerySelector(".menu").empty());
+        REQUIRE(list.QuerySelector("ul > li").empty());
+        REQUIRE(list.QuerySelector("li:first-child").size() == 1);
+
+        const CTML::Node& constant = list;
+
+        REQUIRE(constant.QuerySelector("li").front() == list.FirstChild());
+        REQUIRE(constant.QuerySelectorParallel(".item").size() == 3);
+    }
+
+    SECTION("siblings are inserted and removed in place")
+    {
+        CTML::Node node("ol>li.a+li.c");
+
+        CTML::Node* c = node.LastChild();
+
+        c->InsertBefore(CTML::Node("li.b"))
+          .InsertAfter(CTML::Node("li.d"));
+
+        REQUIRE(node.ToString() == "<ol><li class=\"a\"></li><li class=\"b\"></li><li class=\"c\"></li><li class=\"d\"></li></ol>");
+        REQUIRE(c->PreviousSibling()->GetAttribute("class") == "b");
+        REQUIRE(c->NextSibling()->GetAttribute("class") == "d");
+
+        c->Remove();
+
+        REQUIRE(node.ChildCount() == 3);
+        REQUIRE(node.ToString() == "<ol><li class=\"a\"></li><li class=\"b\"></li><li class=\"d\"></li></ol>");
+    }
+
+    SECTION("attributes keep the order they were first set in")
+    {
+        CTML::Node node("div");
+
+        for (int index = 0; index < 12; index++)
+            node.SetAttribute("data-" + std::to_string(index), std::to_string(index));
+
+        node.SetAttribute("data-3", "three")
+            .RemoveAttribute("data-5");
+
+        REQUIRE(node.GetAttribute("data-3") == "three");
+        REQUIRE(node.GetAttribute("data-5") == "");
+        REQUIRE(node.GetAttribute("data-11") == "11");
+
+        CTML::Node copy = node;
+
+        copy.RemoveAttribute("data-0");
+
+        REQUIRE(copy.ToString() == "<div data-1=\"1\" data-2=\"2\" data-3=\"three\" data-4=\"4\" data-6=\"6\" data-7=\"7\" data-8=\"8\" data-9=\"9\" data-10=\"10\" data-11=\"11\"></div>");
+        REQUIRE(copy.GetAttribute("data-11") == "11");
+        REQUIRE(node.GetAttribute("data-0") == "0");
+    }
+
+    SECTION("class queries follow class changes")
+    {
+        CTML::Node node("div");
+
+        node.AppendChild(CTML::Node("p.a.b.c"))
+            .AppendChild(CTML::Node("p.a.c"))
+            .AppendChild(CTML::Node("p.b"));
+
+        REQUIRE(node.QuerySelector(".a.b.c").size() == 1);
+        REQUIRE(node.QuerySelector(".a.c").size() == 2);
+
+        node.GetChild(0).ToggleClass("b");
+        node.GetChild(2).SetAttribute("class", "a c b");
+
+        REQUIRE(node.QuerySelector(".a.b.c").size() == 1);
+        REQUIRE(node.QuerySelector(".a.b.c").front() == &node.GetChild(2));
+        REQUIRE(node.QuerySelector(".a.c").size() == 3);
+
+        node.GetChild(2).RemoveAttribute("class");
+
+        REQUIRE(node.QuerySelector(".b").empty());
+    }
+
+    SECTION("several selectors are searched in one traversal")
+    {
+        CTML::Node node("div.root");
+
+        node.AppendChild(CTML::Node("div.outer>div.inner>p#first.text"))
+            .AppendChild(CTML::Node("p.text").SetAttribute("disabled", ""))
+            .AppendChild(CTML::Node("span.text", "Hello"));
+
+        std::vector<std::vector<CTML::Node*>> matches = node.QuerySelectorAll({ "p", ".text", "#first", "div div", "[disabled]", "section" });
+
+        REQUIRE(matches.size() == 6);
+        REQUIRE(matches[0].size() == 2);
+        REQUIRE(matches[0][0]->GetAttribute("id") == "first");
+        REQUIRE(matches[0][1] == &node.GetChild(1));
+        REQUIRE(matches[1].size() == 3);
+        REQUIRE(matches[1][2] == &node.GetChild(2));
+        REQUIRE(matches[2].size() == 1);
+        REQUIRE(matches[3].size() == 1);
+        REQUIRE(matches[3][0]->GetAttribute("class") == "inner");
+        REQUIRE(matches[4].size() == 1);
+        REQUIRE(matches[4][0] == &node.GetChild(1));
+        REQUIRE(matches[5].empty());
+
+        REQUIRE(node.QuerySelector("div div").size() == 1);
+        REQUIRE(node.QuerySelector("div p[disabled]").empty());
+        REQUIRE(node.QuerySelector("div.outer p.text#first").size() == 1);
+    }
+
+    SECTION("selector lists are searched as a union")
+    {
+        CTML::Node node("div");
+
+        node.AppendChild(CTML::Node("h2.title", "Two"))
+            .AppendChild(CTML::Node("h1.title", "One"))
+            .AppendChild(CTML::Node("p").SetAttribute("data-list", "a,b"))
+            .AppendChild(CTML::Node("h3", "Three"));
+
+        std::vector<CTML::Node*> matches = node.QuerySelector("h1, h2,h3 , .title");
+
+        REQUIRE(matches.size() == 3);
+        REQUIRE(matches[0] == &node.GetChild(0));
+        REQUIRE(matches[1] == &node.GetChild(1));
+        REQUIRE(matches[2] == &node.GetChild(3));
+
+        REQUIRE(node.QuerySelector("[data-list=\"a,b\"]").size() == 1);
+        REQUIRE(node.QuerySelector(", h1 ,").size() == 1);
+        REQUIRE(node.QuerySelectorAll({ "h1, h3", "h2" })[0].size() == 2);
+    }
+
+    SECTION("child and sibling combinators narrow matches")
+    {
+        CTML::Node node("div");
+
+        node.AppendChild(CTML::Node("ul.menu>li.first+li+li.last>ul>li"))
+            .AppendChild(CTML::Node("h2"))
+            .AppendText("Between")
+            .AppendChild(CTML::Node("p.one"))
+            .AppendChild(CTML::Node("p.two"));
+
+        REQUIRE(node.QuerySelector("ul li").size() == 4);
+        REQUIRE(node.QuerySelector("ul > li").size() == 4);
+        REQUIRE(node.QuerySelector("ul.menu > li").size() == 3);
+        REQUIRE(node.QuerySelector("ul.menu>li>ul>li").size() == 1);
+        REQUIRE(node.QuerySelector(".first + li").size() == 1);
+        REQUIRE(node.QuerySelector(".first ~ li").size() == 2);
+        REQUIRE(node.QuerySelector(".first ~ li")[1]->GetAttribute("class") == "last");
+        REQUIRE(node.QuerySelector("h2 + p").front() == &node.GetChild(3));
+        REQUIRE(node.QuerySelector("h2 ~ p").size() == 2);
+        REQUIRE(node.QuerySelector("h2 + .two").empty());
+        REQUIRE(node.QuerySelector("ul ~ *").size() == 3);
+        REQUIRE(node.QuerySelector("li[class~=\"last\"] > ul").size() == 1);
+    }
+
+    SECTION("structural pseudo-classes use sibling positions")
+    {
+        CTML::Node table("table");
+
+        table.AppendChild(CTML::Node("tr.header>th"))
+            .AppendText("Rows");
+
+        for (int row = 0; row < 5; row++)
+            table.AppendChild(CTML::Node("tr>td"));
+
+        table.AppendChild(CTML::Node("caption"))
+            .AppendChild(CTML::Node(CTML::NodeType::COMMENT, "End"));
+
+        REQUIRE(table.QuerySelector("tr:first-child").front() == &table.GetChild(0));
+        REQUIRE(table.QuerySelector(":last-child").size() == 7);
+        REQUIRE(table.QuerySelector("table > :last-child").empty());
+        REQUIRE(table.QuerySelector("caption:last-child").size() == 1);
+        REQUIRE(table.QuerySelector("tr:nth-child(odd)").size() == 3);
+        REQUIRE(table.QuerySelector("tr:nth-child(2n)").size() == 3);
+        REQUIRE(table.QuerySelector("tr:nth-child(2n)").front() == &table.GetChild(2));
+        REQUIRE(table.QuerySelector("tr:nth-child(-n+3)").size() == 3);
+        REQUIRE(table.QuerySelector("tr:nth-child(4)").front() == &table.GetChild(4));
+        REQUIRE(table.QuerySelector(":nth-of-type(1)").size() == 8);
+        REQUIRE(table.QuerySelector("caption:nth-of-type(1)").size() == 1);
+        REQUIRE(table.QuerySelector("caption:nth-child(7)").size() == 1);
+        REQUIRE(table.QuerySelector("td:empty").size() == 5);
+        REQUIRE(table.QuerySelector("tr:not(.header)").size() == 5);
+        REQUIRE(table.QuerySelector("tr:not(.header, :nth-child(2n+1)) td").size() == 3);
+        REQUIRE(table.QuerySelector(":first-child + tr:nth-child(2)").size() == 1);
+        REQUIRE(table.QuerySelector("tr:hover").empty());
+        REQUIRE(table.QuerySelector("tr:nth-child(x)").empty());
+        REQUIRE(table.QuerySelector("tr:nth-child( 2n + 1 )").size() == 3);
+        REQUIRE(table.QuerySelector("tr:nth-child(2n- 1)").size() == 3);
+        REQUIRE(table.QuerySelector("tr:nth-child(2n1)").empty());
+        REQUIRE(table.QuerySelector("tr:nth-child(1-2)").empty());
+        REQUIRE(table.QuerySelector("tr:nth-child(2 n+1)").empty());
+        REQUIRE(table.QuerySelector("tr:nth-child(2n+-1)").empty());
+        REQUIRE(table.QuerySelector("tr:nth-child(99999999999)").empty());
+    }
+
+    SECTION("ancestor filtering does not change matches")
+    {
+        CTML::Node node("div");
+
+        node.AppendChild(CTML::Node("aside.sidebar>div.widget>a"))
+            .AppendChild(CTML::Node("div.widget>a"))
+            .AppendChild(CTML::Node("section#main>p.widget>span>a"));
+
+        REQUIRE(node.QuerySelector(".sidebar .widget a").size() == 1);
+        REQUIRE(node.QuerySelector(".sidebar + .widget a").size() == 1);
+        REQUIRE(node.QuerySelector(".sidebar + section a").empty());
+        REQUIRE(node.QuerySelector(".sidebar ~ div a").size() == 1);
+        REQUIRE(node.QuerySelector("#main .widget a").size() == 1);
+        REQUIRE(node.QuerySelector(".main .widget a").empty());
+        REQUIRE(node.QuerySelector("aside.widget a").empty());
+
+        // nesting deeper than a filter counter can count keeps the counter full rather than losing track
+        CTML::Node deep("div.deep");
+
+        CTML::Node* current = &deep;
+
+        for (int depth = 0; depth < 300; depth++)
+            current = current->AppendChild(CTML::Node("div.deep")).LastChild();
+
+        current->AppendChild(CTML::Node("a"));
+
+        deep.AppendChild(CTML::Node("a"));
+
+        REQUIRE(deep.QuerySelector(".deep a").size() == 1);
+        REQUIRE(deep.QuerySelector("div a").size() == 1);
+        REQUIRE(deep.QuerySelector("a").size() == 2);
+    }
+
+    SECTION("parallel queries match sequential queries")
+    {
+        CTML::Node node("div");
+
+        for (int section = 0; section < 20; section++)
+        {
+            node.AppendChild(CTML::Node("section>ul.list>li.item*4>a"))
+                .AppendText("Text")
+                .AppendChild(CTML::Node("p.item"));
+        }
+
+        std::vector<CTML::Node*> expected = node.QuerySelector("section + p, .list .item");
+
+        REQUIRE(expected.size() == 100);
+
+        const CTML::Node& constant = node;
+
+        for (unsigned threads : { 0u, 1u, 3u, 64u })
+        {
+            std::vector<const CTML::Node*> matches = constant.QuerySelectorParallel("section + p, .list .item", threads);
+
+            REQUIRE(matches.size() == expected.size());
+            REQUIRE(std::equal(matches.begin(), matches.end(), expected.begin()));
+        }
+
+        REQUIRE(CTML::Node("div").QuerySelectorParallel("p").empty());
+    }
+
+    SECTION("const documents can be searched without casts")
+    {
+        CTML::Document document;
+
+        document.AppendNodeToHead(CTML::Node("title", "Page"));
+        document.AppendNodeToBody(CTML::Node("main>p.text*2"));
+
+        CTML::Document copy = document;
+
+        const CTML::Document& constant = copy;
+
+        REQUIRE(constant.head().GetChildByName("title").ToString() == "<title>Page</title>");
+        REQUIRE(&constant.body() == &constant.html().GetChildByName("body"));
+        REQUIRE(constant.QuerySelector("main > .text").size() == 2);
+        REQUIRE(constant.QuerySelectorAll({ "title", "p" })[1].size() == 2);
+
+        // a const search reads the children that are still shared with the original in place
+        const CTML::Document& original = document;
+
+        REQUIRE(constant.QuerySelector("title").front() == original.head().FirstChild());
+
+        copy.body().AppendChild(CTML::Node("p.text"));
+
+        REQUIRE(constant.QuerySelector(".text").size() == 3);
+        REQUIRE(original.QuerySelector(".text").size() == 2);
+    }
+
+    SECTION("frozen documents keep the state they were taken in")
+    {
+        CTML::Document document;
+
+        document.AppendNodeToBody(CTML::Node("p.text", "One & two"));
+
+        CTML::FrozenDocument frozen = document.Freeze();
+
+        document.AppendNodeToBody(CTML::Node("p.text", "Three"));
+        document.body().GetChild(0).SetAttribute("class", "changed");
+
+        REQUIRE(frozen.ToString() == "<!DOCTYPE html><html><head></head><body><p class=\"text\">One &amp; two</p></body></html>");
+        REQUIRE(frozen.Size() == frozen.ToString().size());
+        REQUIRE(frozen.ToString(CTML::ToStringOptions()) == frozen.ToString());
+        REQUIRE(frozen.ToString(CTML::ToStringOptions(CTML::StringFormatting::MULTIPLE_LINES)).find("One &amp; two") != std::string::npos);
+        REQUIRE(frozen.QuerySelector(".text").size() == 1);
+        REQUIRE(frozen.QuerySelectorAll({ ".changed" })[0].empty());
+        REQUIRE(document.QuerySelector(".text").size() == 1);
+
+        CTML::FrozenDocument copy = frozen;
+
+        REQUIRE(&copy.ToString() == &frozen.ToString());
+        REQUIRE(&copy.GetDocument() == &frozen.GetDocument());
+    }
+
+    SECTION("escaped values follow changes")
+    {
+        CTML::Node node("p", "One < two");
+
+        node.SetAttribute("title", "\"Quoted\"");
+
+        REQUIRE(node.ToString() == "<p title=\"&quot;Quoted&quot;\">One &lt; two</p>");
+        REQUIRE(node.GetChild(0).ToString(CTML::ToStringOptions(CTML::StringFormatting::SINGLE_LINE, false, 0, false)) == "One < two");
+
+        node.SetAttribute("title", "Plain");
+        node.GetChild(0).SetContent("Three & four");
+
+        REQUIRE(node.ToString() == "<p title=\"Plain\">Three &amp; four</p>");
+
+        node.GetChild(0).SetType(CTML::NodeType::COMMENT);
+
+        REQUIRE(node.ToString() == "<p title=\"Plain\"><!--Three & four--></p>");
+
+        node.GetChild(0).SetType(CTML::NodeType::TEXT);
+
+        REQUIRE(node.ToString() == "<p title=\"Plain\">Three &amp; four</p>");
+        REQUIRE(node.GetAttribute("title") == "Plain");
+    }
+
+    SECTION("trusted content is never escaped")
+    {
+        CTML::Node node("div");
+
+        node.AppendText("<b>")
+            .AppendRaw("<i>Already &amp; escaped</i>")
+            .AppendChild(CTML::Node("p", "a & b"));
+
+        REQUIRE(node.ToString() == "<div>&lt;b&gt;<i>Already &amp; escaped</i><p>a &amp; b</p></div>");
+
+        CTML::ToStringOptions unescaped(CTML::StringFormatting::SINGLE_LINE, false, 0, false);
+
+        REQUIRE(node.ToString(unescaped) == "<div><b><i>Already &amp; escaped</i><p>a & b</p></div>");
+
+        node.GetChild(1).SetContent("<u>");
+
+        REQUIRE(node.ToString() == "<div>&lt;b&gt;<u><p>a &amp; b</p></div>");
+    }
+
+    SECTION("attribute values are escaped for their context")
+    {
+        CTML::Node link("a");
+
+        link.SetAttribute("href", "/search?q=fish & chips&lang=\"en\"#top", CTML::EscapeContext::URL)
+            .SetAttribute("onclick", "show('It\\'s <here>\n')", CTML::EscapeContext::JAVASCRIPT_STRING)
+            .SetAttribute("style", "content: \"a\\b\"", CTML::EscapeContext::CSS_STRING)
+            .SetAttribute("title", "Fish & chips");
+
+        REQUIRE(link.ToString() ==
+            "<a href=\"/search?q=fish%20&amp;%20chips&amp;lang=%22en%22#top\""
+            " onclick=\"show(\\x27It\\\\\\x27s \\x3Chere\\x3E\\n\\x27)\""
+            " style=\"content: \\22 a\\5C b\\22 \""
+            " title=\"Fish &amp; chips\"></a>");
+
+        REQUIRE(link.GetAttribute("href") == "/search?q=fish & chips&lang=\"en\"#top");
+
+        link.SetAttribute("href", "/caf\xC3\xA9", CTML::EscapeContext::URL);
+
+        REQUIRE(link.ToString().find("href=\"/caf%C3%A9\"") != std::string::npos);
+
+        // long values go through the vectorized scanner, and the line separator is escaped for JavaScript
+        std::string value(40, 'x');
+
+        value += "\xE2\x80\xA8";
+        value += std::string(20, 'y');
+        value += "<";
+
+        REQUIRE(CTML::javascript_string_escape(value) == std::string(40, 'x') + "\\u2028" + std::string(20, 'y') + "\\x3C");
+        REQUIRE(CTML::html_escape(std::string(33, 'z') + "\"'") == std::string(33, 'z') + "&quot;&apos;");
+        REQUIRE(CTML::html_escape(std::string(33, 'z') + "\"'", false) == std::string(33, 'z') + "\"'");
+        REQUIRE(CTML::css_string_escape("\x01\n") == "\\1 \\A ");
+    }
+
+    SECTION("output can be validated and encoded as ASCII")
+    {
+        CTML::Node node("p.caf\xC3\xA9", "Caf\xC3\xA9 \xF0\x9F\x8D\xB5 & bad \xC0\xAF end");
+
+        node.SetAttribute("title", "\xE2\x82\xAC" "5");
+
+        CTML::ToStringOptions validated(CTML::StringFormatting::SINGLE_LINE, false, 0, true, CTML::OutputEncoding::VALIDATED_UTF8);
+        CTML::ToStringOptions ascii(CTML::StringFormatting::SINGLE_LINE, false, 0, true, CTML::OutputEncoding::ASCII);
+
+        REQUIRE(node.ToString() == "<p class=\"caf\xC3\xA9\" title=\"\xE2\x82\xAC" "5\">Caf\xC3\xA9 \xF0\x9F\x8D\xB5 &amp; bad \xC0\xAF end</p>");
+        REQUIRE(node.ToString(validated) == "<p class=\"caf\xC3\xA9\" title=\"\xE2\x82\xAC" "5\">Caf\xC3\xA9 \xF0\x9F\x8D\xB5 &amp; bad \xEF\xBF\xBD\xEF\xBF\xBD end</p>");
+        REQUIRE(node.ToString(ascii) == "<p class=\"caf&#xE9;\" title=\"&#x20AC;5\">Caf&#xE9; &#x1F375; &amp; bad &#xFFFD;&#xFFFD; end</p>");
+
+        // truncated sequences and surrogates are invalid too
+        CTML::Node text(CTML::NodeType::TEXT, std::string(20, 'a') + "\xED\xA0\x80" + "\xE2\x82");
+
+        REQUIRE(text.ToString(ascii) == std::string(20, 'a') + "&#xFFFD;&#xFFFD;&#xFFFD;&#xFFFD;&#xFFFD;");
+    }
+
+    SECTION("entities are decoded back to text")
+    {
+        REQUIRE(CTML::html_unescape("Fish &amp; chips &lt;3 &quot;&apos;") == "Fish & chips <3 \"'");
+        REQUIRE(CTML::html_unescape("caf&eacute; &euro;5 &#38;&#x26;&#X26; &#233") == "caf\xC3\xA9 \xE2\x82\xAC" "5 &&& \xC3\xA9");
+        REQUIRE(CTML::html_unescape("&#x1F375;") == "\xF0\x9F\x8D\xB5");
+        REQUIRE(CTML::html_unescape("&#0; &#xD800; &#99999999999;") == "\xEF\xBF\xBD \xEF\xBF\xBD \xEF\xBF\xBD");
+        REQUIRE(CTML::html_unescape("&unknown; &amp &; & &#; &#x;") == "&unknown; &amp &; & &#; &#x;");
+        REQUIRE(CTML::html_unescape(std::string(40, 'a') + "&lt;" + std::string(20, 'b')) == std::string(40, 'a') + "<" + std::string(20, 'b'));
+
+        std::string text = "<p class=\"x\">Fish & chips</p>";
+
+        REQUIRE(CTML::html_unescape(CTML::html_escape(text)) == text);
+
+        CTML::Node node("p");
+
+        node.AppendText(CTML::html_unescape("a &lt; b"));
+
+        REQUIRE(node.ToString() == "<p>a &lt; b</p>");
+    }
+
+    SECTION("compiled templates fill in their slots")
+    {
+        CTML::Node row("tr");
+
+        row.SetAttributeSlot("data-href", "href", CTML::EscapeContext::URL)
+           .AppendChild(CTML::Node("td").AppendSlot("name"));
+
+        CTML::Node table("table.users");
+
+        table.AppendChild(CTML::Node("caption").AppendSlot("title"))
+             .AppendSlot("rows", row);
+
+        // slots are left out of a normal render
+        REQUIRE(table.ToString() == "<table class=\"users\"><caption></caption></table>");
+
+        CTML::Template plan = table.Compile();
+
+        REQUIRE(plan.StaticBytes() == "<table class=\"users\"><caption></caption></table>");
+        REQUIRE(plan.Slots().size() == 2);
+
+        CTML::TemplateValues values;
+
+        values.Set("title", "Fish & chips");
+        values.AddItem("rows").Set("name", "<b>Ann</b>").Set("href", "/u/ann lee");
+        values.AddItem("rows").Set("name", "Bob");
+
+        REQUIRE(plan.Render(values) ==
+            "<table class=\"users\"><caption>Fish &amp; chips</caption>"
+            "<tr data-href=\"/u/ann%20lee\"><td>&lt;b&gt;Ann&lt;/b&gt;</td></tr>"
+            "<tr data-href=\"\"><td>Bob</td></tr></table>");
+
+        // the render matches the same tree built with the values
+        CTML::Node built("p");
+
+        built.SetAttribute("title", "a \"quote\"")
+             .AppendText("x < y");
+
+        CTML::Node slotted("p");
+
+        slotted.SetAttributeSlot("title", "title")
+               .AppendSlot("text");
+
+        CTML::TemplateValues text;
+
+        text.Set("title", "a \"quote\"").Set("text", "x < y");
+
+        CTML::ToStringOptions multiline(CTML::StringFormatting::MULTIPLE_LINES);
+
+        REQUIRE(slotted.Compile().Render(text) == built.ToString());
+        REQUIRE(slotted.Compile(multiline).Render(text) == built.ToString(multiline));
+    }
+
+    SECTION("cached nodes are rendered through the fragment cache")
+    {
+        CTML::FragmentCache cache(1 << 20);
+
+        CTML::Node widget("aside.widget", "Latest posts");
+
+        widget.SetCacheKey("widget:v1");
+
+        CTML::Node page("main");
+
+        page.AppendChild(widget);
+
+        CTML::ToStringOptions options(CTML::StringFormatting::SINGLE_LINE, false, 0, true, CTML::OutputEncoding::UTF8, &cache);
+
+        REQUIRE(page.ToString(options) == "<main><aside class=\"widget\">Latest posts</aside></main>");
+        REQUIRE(cache.Count() == 1);
+
+        // the widget is copied from the cache until its key changes
+        page.FirstChild()->AppendText(" changed");
+
+        REQUIRE(page.ToString(options) == "<main><aside class=\"widget\">Latest posts</aside></main>");
+
+        page.FirstChild()->SetCacheKey("widget:v2");
+
+        REQUIRE(page.ToString(options) == "<main><aside class=\"widget\">Latest posts changed</aside></main>");
+        REQUIRE(page.ToString() == "<main><aside class=\"widget\">Latest posts changed</aside></main>");
+
+        // the same node is stored separately for different options
+        CTML::ToStringOptions multiline(CTML::StringFormatting::MULTIPLE_LINES, true, 0, true, CTML::OutputEncoding::UTF8, &cache);
+
+        REQUIRE(page.ToString(multiline) == page.ToString(CTML::ToStringOptions(CTML::StringFormatting::MULTIPLE_LINES, true)));
+        REQUIRE(cache.Count() == 3);
+
+        cache.Clear();
+
+        REQUIRE(cache.Count() == 0);
+        REQUIRE(cache.Size() == 0);
+    }
+
+    SECTION("the fragment cache evicts the least recently used fragments")
+    {
+        CTML::FragmentCache cache(30, std::chrono::milliseconds(0), 1);
+
+        cache.Put("a", std::string(9, 'a'));
+        cache.Put("b", std::string(9, 'b'));
+        cache.Put("c", std::string(9, 'c'));
+
+        REQUIRE(cache.Size() == 30);
+
+        // using a makes b the least recently used
+        REQUIRE(*cache.Get("a") == std::string(9, 'a'));
+
+        cache.Put("d", std::string(9, 'd'));
+
+        REQUIRE(cache.Get("b") == nullptr);
+        REQUIRE(cache.Get("a") != nullptr);
+        REQUIRE(cache.Get("c") != nullptr);
+        REQUIRE(cache.Get("d") != nullptr);
+        REQUIRE(cache.Size() == 30);
+
+        REQUIRE(cache.Erase("a"));
+        REQUIRE_FALSE(cache.Erase("a"));
+        REQUIRE(cache.Size() == 20);
+
+        // fragments larger than the budget are never stored
+        REQUIRE(*cache.Put("e", std::string(40, 'e')) == std::string(40, 'e'));
+        REQUIRE(cache.Get("e") == nullptr);
+
+        // a fragment can use more than the share of a single shard, up to the whole budget
+        CTML::FragmentCache sharded(1600);
+
+        REQUIRE(*sharded.Put("large", std::string(1000, 'l')) == std::string(1000, 'l'));
+        REQUIRE(sharded.Get("large") != nullptr);
+        REQUIRE(sharded.Size() == 1005);
+
+        // storing another one evicts fragments from any shard to stay within the budget
+        sharded.Put("other", std::string(1000, 'o'));
+
+        REQUIRE(sharded.Get("other") != nullptr);
+        REQUIRE(sharded.Get("large") == nullptr);
+        REQUIRE(sharded.Count() == 1);
+        REQUIRE(sharded.Size() == 1005);
+
+        CTML::FragmentCache expiring(1024, std::chrono::milliseconds(1));
+
+        expiring.Put("a", "fragment");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        REQUIRE(expiring.Get("a") == nullptr);
+        REQUIRE(expiring.Count() == 0);
+    }
+
+    SECTION("subtree hashes follow changes to the content")
+    {
+        CTML::Node list("ul.menu");
+
+        list.AppendChild(CTML::Node("li", "One").SetAttribute("data-a", "1").SetAttribute("data-b", "2"))
+            .AppendChild(CTML::Node("li", "Two"));
+
+        CTML::Node same("ul.menu");
+
+        same.AppendChild(CTML::Node("li", "One").SetAttribute("data-b", "2").SetAttribute("data-a", "1"))
+            .AppendChild(CTML::Node("li", "Two"));
+
+        const uint64_t hash = list.Hash();
+
+        // attributes are hashed in order of their names, and copies keep the same hash
+        REQUIRE(same.Hash() == hash);
+        REQUIRE(CTML::Node(list).Hash() == hash);
+        REQUIRE(list.Hash() == hash);
+
+        // a change deep in the tree changes the hash of every node above it
+        const uint64_t second = list.GetChild(1).Hash();
+
+        list.GetChild(0).GetChild(0).SetContent("Uno");
+
+        REQUIRE(list.GetChild(1).Hash() == second);
+        REQUIRE(list.Hash() != hash);
+
+        list.GetChild(0).GetChild(0).SetContent("One");
+
+        REQUIRE(list.Hash() == hash);
+
+        // changing a copy leaves the original alone
+        CTML::Node copy = list;
+
+        copy.GetChild(1).ToggleClass("active");
+
+        REQUIRE(copy.Hash() != hash);
+        REQUIRE(list.Hash() == hash);
+
+        copy.GetChild(1).ToggleClass("active");
+
+        REQUIRE(copy.Hash() == hash);
+
+        // structural changes change the hash too
+        list.GetChild(1).InsertAfter(CTML::Node("li", "Three"));
+
+        const uint64_t inserted = list.Hash();
+
+        REQUIRE(inserted != hash);
+
+        list.LastChild()->Remove();
+
+        REQUIRE(list.Hash() == hash);
+
+        list.GetChild(1) = CTML::Node("li", "Deux");
+
+        REQUIRE(list.Hash() != hash);
+
+        // appending a node that is in another tree copies it without taking it from that tree
+        CTML::Node source("div>p");
+        CTML::Node target("div");
+
+        const uint64_t sourceHash = source.Hash();
+
+        target.AppendChild(*source.FirstChild());
+
+        source.FirstChild()->SetAttribute("x", "y");
+
+        REQUIRE(source.Hash() != sourceHash);
+        REQUIRE(target.ToString() == "<div><p></p></div>");
+        REQUIRE(CTML::Diff(CTML::Node("div>p"), source).size() == 1);
+
+        CTML::Document document;
+        CTML::Document other;
+
+        REQUIRE(document.Hash() == other.Hash());
+
+        other.AppendNodeToBody(CTML::Node("p"));
+
+        REQUIRE(document.Hash() != other.Hash());
+    }
+
+    SECTION("diffs patch one tree into another")
+    {
+        CTML::Node before("ul.list");
+
+        before.AppendChild(CTML::Node("li#a.item", "A"))
+              .AppendChild(CTML::Node("li#b.item", "B"))
+              .AppendChild(CTML::Node("li#c.item", "C"))
+              .AppendChild(CTML::Node("p", "Footer").SetAttribute("title", "old"));
+
+        // equal trees need no operations
+        REQUIRE(CTML::Diff(before, CTML::Node(before)).empty());
+
+        CTML::Node after("ul.list.wide");
+
+        after.AppendChild(CTML::Node("li#c.item", "C"))
+             .AppendChild(CTML::Node("li#a.item.active", "A"))
+             .AppendChild(CTML::Node("li#d.item", "D"))
+             .AppendChild(CTML::Node("p", "New footer").SetAttribute("data-x", "1 & 2"));
+
+        std::vector<CTML::PatchOperation> operations = CTML::Diff(before, after);
+
+        CTML::Node patched = before;
+
+        CTML::Patch(patched, operations);
+
+        REQUIRE(patched.ToString() == after.ToString());
+        REQUIRE(patched.Hash() == after.Hash());
+
+        // b is removed, c is moved by removing and inserting it, and a is changed in place
+        REQUIRE(operations.size() == 9);
+        REQUIRE(operations[0].type == CTML::PatchType::TOGGLE_CLASS);
+        REQUIRE(operations[0].path.empty());
+        REQUIRE(operations[0].name == "wide");
+        REQUIRE(operations[1].type == CTML::PatchType::REMOVE);
+        REQUIRE(operations[1].path == std::vector<size_t>{ 2 });
+        REQUIRE(operations[2].type == CTML::PatchType::REMOVE);
+        REQUIRE(operations[2].path == std::vector<size_t>{ 1 });
+        REQUIRE(operations[3].type == CTML::PatchType::INSERT);
+        REQUIRE(operations[3].path == std::vector<size_t>{ 0 });
+        REQUIRE(operations[3].node->ToString() == "<li class=\"item\" id=\"c\">C</li>");
+        REQUIRE(operations[4].type == CTML::PatchType::TOGGLE_CLASS);
+        REQUIRE(operations[4].path == std::vector<size_t>{ 1 });
+        REQUIRE(operations[5].type == CTML::PatchType::INSERT);
+        REQUIRE(operations[5].path == std::vector<size_t>{ 2 });
+        REQUIRE(operations[6].type == CTML::PatchType::REMOVE_ATTRIBUTE);
+        REQUIRE(operations[6].name == "title");
+        REQUIRE(operations[7].type == CTML::PatchType::SET_ATTRIBUTE);
+        REQUIRE(operations[7].path == std::vector<size_t>{ 3 });
+        REQUIRE(operations[7].value == "1 & 2");
+        REQUIRE(operations[8].type == CTML::PatchType::REPLACE_TEXT);
+        REQUIRE(operations[8].path == (std::vector<size_t>{ 3, 0 }));
+        REQUIRE(operations[8].value == "New footer");
+
+        // children without an id are matched to equal children first, so inserting one at the front is one operation
+        CTML::Node rows("tbody");
+
+        for (int index = 0; index < 5; index++)
+            rows.AppendChild(CTML::Node("tr").AppendChild(CTML::Node("td", std::to_string(index))));
+
+        CTML::Node inserted("tbody");
+
+        inserted.AppendChild(CTML::Node("tr").AppendChild(CTML::Node("td", "new")));
+
+        for (int index = 0; index < 5; index++)
+            inserted.AppendChild(CTML::Node("tr").AppendChild(CTML::Node("td", std::to_string(index))));
+
+        operations = CTML::Diff(rows, inserted);
+
+        REQUIRE(operations.size() == 1);
+        REQUIRE(operations[0].type == CTML::PatchType::INSERT);
+        REQUIRE(operations[0].path == std::vector<size_t>{ 0 });
+
+        // elements that change into another kind of node are replaced, along with reordered classes and attributes
+        CTML::Node from("div.a.b");
+
+        from.SetAttribute("x", "1")
+            .SetAttribute("y", "2")
+            .AppendChild(CTML::Node("span", "text"))
+            .AppendText("loose");
+
+        CTML::Node to("div.b.a");
+
+        to.SetAttribute("y", "2")
+          .SetAttribute("x", "1")
+          .AppendChild(CTML::Node("em", "text"))
+          .AppendChild(CTML::Node(CTML::NodeType::COMMENT, "note"));
+
+        CTML::Node result = from;
+
+        CTML::Patch(result, CTML::Diff(from, to));
+
+        REQUIRE(result.ToString() == to.ToString());
+
+        CTML::Node replaced = from;
+
+        CTML::Patch(replaced, CTML::Diff(from, CTML::Node("section", "other")));
+
+        REQUIRE(replaced.ToString() == "<section>other</section>");
+
+        // an attribute that was left to a slot is set again, which clears the slot
+        CTML::Node slotted("a");
+
+        slotted.SetAttributeSlot("href", "u");
+
+        CTML::Node filled("a[href=\"\"]");
+
+        CTML::Node unslotted = slotted;
+
+        CTML::Patch(unslotted, CTML::Diff(slotted, filled));
+
+        REQUIRE(unslotted.Hash() == filled.Hash());
+        REQUIRE(unslotted.Compile().Render(CTML::TemplateValues().Set("u", "x")) == filled.ToString());
+    }
+}
@@ -23,11 +23,8 @@ TEST_CASE("nodes are constructed correctly", "[node_construct]") {
     SECTION("basic node with constructor content, classes, id, and attributes constructed correctly") {
         CTML::Node node("p.class.test#test[title=\"test title\"][disabled]", "Hello world!");
 
-        // attribute order does not matter for this test, so just have both orders
-        bool nodeStrEqual = (node.ToString() == "<p class=\"class test\" id=\"test\" disabled title=\"test title\">Hello world!</p>") ||
-                            (node.ToString() == "<p class=\"class test\" id=\"test\" title=\"test title\" disabled>Hello world!</p>");
-
-        REQUIRE(nodeStrEqual == true);
+        // attributes are output in the order they were set
+        REQUIRE(node.ToString() == "<p class=\"class test\" id=\"test\" title=\"test title\" disabled>Hello world!</p>");
     }
 
     SECTION("multiple node construction from selector-based name") {
@@ -35,4 +32,54 @@ TEST_CASE("nodes are constructed correctly", "[node_construct]") {
 
         REQUIRE(node.ToString() == "<p class=\"test\"><div class=\"nested\"><section class=\"selectors\"></section></div></p>");
     }
-}
\ No newline at end of file
+
+    SECTION("child and sibling abbreviation operators construct correctly") {
+        CTML::Node node("div>header+section.main>p", "");
+
+        REQUIRE(node.ToString() == "<div><header></header><section class=\"main\"><p></p></section></div>");
+    }
+
+    SECTION("multiplied abbreviation with numbering constructs correctly") {
+        CTML::Node node("ul>li.item$*3>a[href=\"#$$\"]");
+
+        REQUIRE(node.ToString() == "<ul><li class=\"item1\"><a href=\"#01\"></a></li><li class=\"item2\"><a href=\"#02\"></a></li><li class=\"item3\"><a href=\"#03\"></a></li></ul>");
+    }
+
+    SECTION("multiplied siblings construct correctly") {
+        CTML::Node node("tr > th*2 + td.cell*2");
+
+        REQUIRE(node.ToString() == "<tr><th></th><th></th><td class=\"cell\"></td><td class=\"cell\"></td></tr>");
+    }
+
+    SECTION("oversized multipliers are clamped") {
+        CTML::Node node("ul>li*99999999999999999999999");
+
+        const size_t maximum = CTML::AbbreviationSegment::MAX_MULTIPLIER;
+
+        REQUIRE(node.ChildCount() == maximum);
+        REQUIRE(CTML::Node("ul>li*0").ChildCount() == 1);
+    }
+
+    SECTION("nested multipliers are limited in total") {
+        const CTML::Node node("div>ul*200>li*200>span*200");
+
+        const size_t maximum = CTML::AbbreviationSegment::MAX_NODES;
+
+        REQUIRE(node.QuerySelector("*").size() == maximum);
+        REQUIRE(node.QuerySelector("ul").size() == 3);
+        REQUIRE(node.FirstChild()->ChildCount() == 200);
+        REQUIRE(node.FirstChild()->LastChild()->ChildCount() == 200);
+
+        // the nodes are built in document order, so the last list is the one cut short
+        REQUIRE(node.LastChild()->QuerySelector("*").size() == maximum - 2 * 40201 - 1);
+    }
+
+    SECTION("namespaced names keep their colon") {
+        CTML::Node path("svg:path.icon");
+        CTML::Node plain("svg:path");
+
+        REQUIRE(path.ToString() == "<svg:path class=\"icon\"></svg:path>");
+        REQUIRE(plain.ToString() == "<svg:path></svg:path>");
+        REQUIRE(CTML::Node("svg>svg:use[href=\"#a\"]").ToString() == "<svg><svg:use href=\"#a\"></svg:use></svg>");
+    }
+}
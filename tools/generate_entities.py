@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""
+Generates the perfect hash table of named HTML entities used by CTML::find_named_entity.
+
+The table uses hash and displace: each name is put in a bucket by its FNV-1a hash, and each bucket is given the
+smallest displacement that moves all of its names to free slots when hashed again with the displacement mixed into
+the seed. Lookups then take two hashes and one string comparison.
+
+Run this script and paste its output into the body of find_named_entity in include/ctml.hpp.
+"""
+import html.entities
+
+FNV_OFFSET = 14695981039346656037
+FNV_PRIME = 1099511628211
+MASK = (1 << 64) - 1
+
+# these must match BUCKET_COUNT and SLOT_COUNT in find_named_entity
+BUCKET_COUNT = 128
+SLOT_COUNT = 512
+
+
+def fnv1a_hash(value, seed=FNV_OFFSET):
+    for byte in value.encode():
+        seed ^= byte
+        seed = (seed * FNV_PRIME) & MASK
+
+    return seed
+
+
+def main():
+    # the HTML 4 entities, along with &apos; from XML, which html_escape outputs
+    entities = dict(html.entities.name2codepoint)
+    entities["apos"] = 0x27
+
+    buckets = {}
+
+    for name in sorted(entities):
+        buckets.setdefault(fnv1a_hash(name) % BUCKET_COUNT, []).append(name)
+
+    slots = [None] * SLOT_COUNT
+    displacements = [0] * BUCKET_COUNT
+
+    # place the largest buckets first, while there is the most room
+    for bucket in sorted(buckets, key=lambda bucket: (-len(buckets[bucket]), bucket)):
+        for displacement in range(256):
+            positions = [fnv1a_hash(name, FNV_OFFSET ^ displacement) % SLOT_COUNT for name in buckets[bucket]]
+
+            if len(set(positions)) == len(positions) and all(slots[position] is None for position in positions):
+                for name, position in zip(buckets[bucket], positions):
+                    slots[position] = name
+
+                displacements[bucket] = displacement
+
+                break
+        else:
+            raise SystemExit("no displacement found for bucket %d" % bucket)
+
+    print("        static const uint8_t displacements[BUCKET_COUNT] = {")
+
+    for index in range(0, BUCKET_COUNT, 16):
+        print("            " + ", ".join("%3d" % value for value in displacements[index:index + 16]) + ",")
+
+    print("        };")
+    print("")
+    print("        static const NamedEntity entities[SLOT_COUNT] = {")
+
+    rows = ['{ "%s", 0x%04X }' % (name, entities[name]) if name else '{ "", 0 }' for name in slots]
+
+    for index in range(0, SLOT_COUNT, 4):
+        print("            " + ", ".join(rows[index:index + 4]) + ",")
+
+    print("        };")
+
+
+if __name__ == "__main__":
+    main()